@@ -0,0 +1,29 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// per-instance data : advanced once per instance
+layout (location = 2) in vec3 instanceOffset;
+layout (location = 3) in vec3 instanceColor;
+
+// view-projection of the view being drawn, shared by every object
+layout (std140) uniform ViewBlock {
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Tiles are only translated, so the model matrix reduces to an offset
+    vec4 v = vec4(vertexPosition + instanceOffset, 1);
+
+    // Per-instance color tints the per-vertex color
+    fragColor = vertexColor * instanceColor;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * v;
+}
@@ -4,7 +4,15 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
 
-uniform mat4 MVP;
+// view-projection of the view being drawn, shared by every object
+layout (std140) uniform ViewBlock {
+    mat4 VP;
+};
+
+// model matrices of the frame's objects, four texels (columns) apiece,
+// and which of them belongs to the object being drawn
+uniform samplerBuffer Models;
+uniform int ObjectIndex;
 
 // output data : used by fragment shader
 out vec3 fragColor;
@@ -12,11 +20,14 @@ out vec3 fragColor;
 void main ()
 {
     vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    int m = ObjectIndex * 4;
+    mat4 Model = mat4(texelFetch(Models, m), texelFetch(Models, m+1),
+                      texelFetch(Models, m+2), texelFetch(Models, m+3));
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
     fragColor = vertexColor;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * Model * position
+    gl_Position = VP * (Model * v);
 }
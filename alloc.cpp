@@ -0,0 +1,317 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <algorithm>
+#include "alloc.h"
+
+using namespace std;
+
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t size;
+  unsigned char* data;
+  unsigned char* top;
+};
+
+Arena frame_arena("frame", 64 << 10);
+Arena level_arena("level", 64 << 10);
+
+Arena::Arena (const char* arena_name, size_t initial_size) :
+  name(arena_name), blocks(NULL), block_size(initial_size), used(0), peak(0), resets(0)
+{
+}
+
+Arena::~Arena ()
+{
+  arenaRelease(*this);
+}
+
+/* Blocks come from operator new, so arena growth shows up in tracking */
+static ArenaBlock* newBlock (size_t size)
+{
+  ArenaBlock* block = (ArenaBlock*) ::operator new(sizeof(ArenaBlock) + size);
+  block->next = NULL;
+  block->size = size;
+  block->data = block->top = (unsigned char*) (block + 1);
+  return block;
+}
+
+void* arenaAlloc (Arena& arena, size_t size, size_t align)
+{
+  ArenaBlock* block = arena.blocks;
+  uintptr_t p = 0;
+  if (block) {
+    p = ((uintptr_t) block->top + align - 1) & ~(uintptr_t) (align - 1);
+    if (p + size > (uintptr_t) (block->data + block->size))
+      block = NULL;
+  }
+  if (!block) {
+    // Each new block at least doubles the arena, and fits the request
+    size_t size_needed = max(arena.block_size, size + align);
+    block = newBlock(size_needed);
+    block->next = arena.blocks;
+    arena.blocks = block;
+    arena.block_size = size_needed*2;
+    p = ((uintptr_t) block->top + align - 1) & ~(uintptr_t) (align - 1);
+  }
+  block->top = (unsigned char*) (p + size);
+  arena.used += size;
+  arena.peak = max(arena.peak, arena.used);
+  return (void*) p;
+}
+
+void arenaReset (Arena& arena)
+{
+  if (arena.blocks && arena.blocks->next) {
+    // Fold the chain into one block that holds all of it
+    size_t total = 0;
+    for (ArenaBlock* block = arena.blocks; block; block = block->next)
+      total += block->size;
+    arenaRelease(arena);
+    arena.blocks = newBlock(total);
+    arena.block_size = total*2;
+  }
+  else if (arena.blocks)
+    arena.blocks->top = arena.blocks->data;
+  arena.used = 0;
+  arena.resets++;
+}
+
+void arenaRelease (Arena& arena)
+{
+  while (arena.blocks) {
+    ArenaBlock* next = arena.blocks->next;
+    ::operator delete(arena.blocks);
+    arena.blocks = next;
+  }
+  arena.used = 0;
+}
+
+static void printArenas (FILE* out)
+{
+  const Arena* arenas[2] = { &frame_arena, &level_arena };
+  for (int a=0; a<2; a++)
+    fprintf(out, "%s arena: %zu bytes peak, %d resets\n", arenas[a]->name, arenas[a]->peak, arenas[a]->resets);
+}
+
+#ifdef ALLOC_TRACKING
+
+/* Counters per tag in a fixed open-addressed table, claimed with a
+ * compare-and-swap so any thread can count without a lock. The last_
+ * and frame fields belong to the main thread. */
+#define ALLOC_TAGS 64
+/* Frames that allocated, kept for the per-frame report */
+#define ALLOC_LOG_SIZE 4096
+
+struct TagCounter {
+  atomic<const char*> tag;
+  atomic<long long> count, bytes, frees;
+  long long last_count, last_bytes, last_frees;
+  long long frame_count, frame_bytes, frame_frees, max_count;
+};
+
+/* One tag's activity in one frame */
+struct FrameAllocs {
+  int frame;
+  const char* tag;
+  long long count, bytes, frees;
+};
+
+/* Every block starts with the counter it was charged to (NULL if
+ * tracking was off), so its free is charged to the same tag whichever
+ * thread frees it. The header keeps the block aligned for any type. */
+struct alignas(max_align_t) AllocHeader {
+  TagCounter* counter;
+};
+
+static TagCounter tag_counters[ALLOC_TAGS];
+static atomic<bool> tracking(false);
+static thread_local const char* current_tag = "other";
+static int tracked_frames = -1;  // -1 until the first frame starts
+static long long startup_count, startup_bytes;
+static FrameAllocs frame_log[ALLOC_LOG_SIZE];
+static int frame_log_used;
+static long long frame_log_dropped;
+
+static TagCounter& tagCounter (const char* tag)
+{
+  unsigned start = (unsigned) (((uintptr_t) tag >> 3) % ALLOC_TAGS);
+  for (int k=0; k<ALLOC_TAGS; k++) {
+    TagCounter& counter = tag_counters[(start + k) % ALLOC_TAGS];
+    const char* owner = counter.tag.load(memory_order_relaxed);
+    if (owner == tag)
+      return counter;
+    if (!owner) {
+      const char* expected = NULL;
+      if (counter.tag.compare_exchange_strong(expected, tag) || expected == tag)
+        return counter;
+    }
+  }
+  return tag_counters[start];  // table full: share a slot
+}
+
+void* operator new (size_t size)
+{
+  AllocHeader* header = (AllocHeader*) malloc(sizeof(AllocHeader) + size);
+  if (!header)
+    throw bad_alloc();
+  header->counter = NULL;
+  if (tracking.load(memory_order_relaxed)) {
+    header->counter = &tagCounter(current_tag);
+    header->counter->count.fetch_add(1, memory_order_relaxed);
+    header->counter->bytes.fetch_add(size, memory_order_relaxed);
+  }
+  return header + 1;
+}
+
+void* operator new[] (size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete (void* p) noexcept
+{
+  if (!p)
+    return;
+  AllocHeader* header = (AllocHeader*) p - 1;
+  if (header->counter)
+    header->counter->frees.fetch_add(1, memory_order_relaxed);
+  free(header);
+}
+
+void operator delete[] (void* p) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete[] (void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+void allocTrackingEnable (bool on)
+{
+  tracking = on;
+}
+
+bool allocTrackingEnabled ()
+{
+  return tracking;
+}
+
+const char* allocSetTag (const char* tag)
+{
+  const char* previous = current_tag;
+  current_tag = tag;
+  return previous;
+}
+
+void allocFrame ()
+{
+  if (!tracking)
+    return;
+  bool first = tracked_frames < 0;
+  for (int t=0; t<ALLOC_TAGS; t++) {
+    TagCounter& counter = tag_counters[t];
+    if (!counter.tag.load())
+      continue;
+    long long count = counter.count, bytes = counter.bytes, frees = counter.frees;
+    long long frame_count = count - counter.last_count, frame_bytes = bytes - counter.last_bytes;
+    long long frame_frees = frees - counter.last_frees;
+    if (first) {
+      // Everything so far was startup, not frame work
+      startup_count += frame_count;
+      startup_bytes += frame_bytes;
+    }
+    else if (frame_count || frame_frees) {
+      counter.frame_count += frame_count;
+      counter.frame_bytes += frame_bytes;
+      counter.frame_frees += frame_frees;
+      counter.max_count = max(counter.max_count, frame_count);
+      if (frame_log_used < ALLOC_LOG_SIZE) {
+        FrameAllocs& entry = frame_log[frame_log_used++];
+        entry.frame = tracked_frames;
+        entry.tag = counter.tag.load();
+        entry.count = frame_count;
+        entry.bytes = frame_bytes;
+        entry.frees = frame_frees;
+      }
+      else
+        frame_log_dropped++;
+    }
+    counter.last_count = count;
+    counter.last_bytes = bytes;
+    counter.last_frees = frees;
+  }
+  tracked_frames++;
+}
+
+void printAllocStats (FILE* out)
+{
+  if (!tracking) {
+    fprintf(out, "allocation tracking is off\n");
+    return;
+  }
+  int frames = max(tracked_frames, 1);
+  fprintf(out, "heap allocations over %d frames (%lld allocations, %lld bytes before the first):\n",
+    max(tracked_frames, 0), startup_count, startup_bytes);
+  fprintf(out, "%-20s %12s %12s %12s %12s\n", "tag", "allocs/frame", "bytes/frame", "max allocs", "frees/frame");
+  for (int t=0; t<ALLOC_TAGS; t++) {
+    const TagCounter& counter = tag_counters[t];
+    if (!counter.tag.load() || (!counter.frame_count && !counter.frame_frees))
+      continue;
+    fprintf(out, "%-20s %12.2f %12.1f %12lld %12.2f\n", counter.tag.load(),
+      (double) counter.frame_count/frames, (double) counter.frame_bytes/frames,
+      counter.max_count, (double) counter.frame_frees/frames);
+  }
+  // Steady frames allocate nothing, so each frame that did is listed
+  if (frame_log_used) {
+    fprintf(out, "%8s %-20s %12s %12s %12s\n", "frame", "tag", "allocs", "bytes", "frees");
+    for (int i=0; i<frame_log_used; i++)
+      fprintf(out, "%8d %-20s %12lld %12lld %12lld\n", frame_log[i].frame, frame_log[i].tag,
+        frame_log[i].count, frame_log[i].bytes, frame_log[i].frees);
+    if (frame_log_dropped)
+      fprintf(out, "(%lld more not kept)\n", frame_log_dropped);
+  }
+  else
+    fprintf(out, "no frame allocated\n");
+  printArenas(out);
+}
+
+#else
+
+/* Without ALLOC_TRACKING the global operator new and delete are the
+ * library's own, and only the arenas are reported */
+static bool tracking = false;
+
+void allocTrackingEnable (bool on)
+{
+  tracking = on;
+}
+
+bool allocTrackingEnabled ()
+{
+  return tracking;
+}
+
+const char* allocSetTag (const char* tag)
+{
+  return tag;
+}
+
+void allocFrame ()
+{
+}
+
+void printAllocStats (FILE* out)
+{
+  fprintf(out, "heap allocations are not counted: build with make ALLOC_TRACKING=1\n");
+  printArenas(out);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Bump allocator over a chain of blocks. Nothing is freed on its own:
+ * the whole arena is reset at once, and objects with destructors must
+ * be destroyed by their owner before that. A reset keeps the memory,
+ * folded into one block big enough for everything the arena held, so
+ * an arena refilled to the same size never goes back to the heap. */
+struct ArenaBlock;
+struct Arena {
+  const char* name;
+  ArenaBlock* blocks;   // the block being filled first
+  size_t block_size;    // size of the next block to allocate
+  size_t used;          // bytes handed out since the last reset
+  size_t peak;          // most bytes handed out between two resets
+  int resets;
+
+  Arena (const char* arena_name, size_t initial_size);
+  ~Arena ();
+  Arena (const Arena&) = delete;
+  Arena& operator= (const Arena&) = delete;
+};
+
+void* arenaAlloc (Arena& arena, size_t size, size_t align=alignof(max_align_t));
+void arenaReset (Arena& arena);
+/* Give every block back to the heap */
+void arenaRelease (Arena& arena);
+
+template <class T, class... Args>
+T* arenaNew (Arena& arena, Args&&... args)
+{
+  return new (arenaAlloc(arena, sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+/* Standard allocator on top of an arena, so containers can use one.
+ * deallocate does nothing; the memory comes back with the reset. */
+template <class T>
+struct ArenaAllocator {
+  typedef T value_type;
+  Arena* arena;
+
+  ArenaAllocator (Arena& a) : arena(&a) {}
+  template <class U> ArenaAllocator (const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate (size_t n) { return (T*) arenaAlloc(*arena, n*sizeof(T), alignof(T)); }
+  void deallocate (T*, size_t) {}
+};
+template <class T, class U>
+bool operator== (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!= (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+/* A vector whose storage is not freed until its arena is reset; growing
+ * one leaves the old storage behind, so reserve when the size is known */
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+/* Temporaries of the frame being drawn: reset at the start of every
+ * frame, main thread only */
+extern Arena frame_arena;
+/* Objects that live exactly as long as the current level: reset when the
+ * level is torn down, main thread only */
+extern Arena level_arena;
+
+/* Allocation tracking, built in with ALLOC_TRACKING (make
+ * ALLOC_TRACKING=1), which replaces the global operator new and delete;
+ * other builds only report the arenas. While it is on, every operator
+ * new is counted against the calling thread's tag - the innermost
+ * ProfileScope or job name - and its delete against the same tag, and
+ * allocFrame records what each tag did in each frame. */
+void allocTrackingEnable (bool on);
+bool allocTrackingEnabled ();
+/* Set this thread's tag; returns the previous one. 'tag' must be a
+ * string literal. */
+const char* allocSetTag (const char* tag);
+/* Call once per frame, on the main thread */
+void allocFrame ();
+/* Allocations per frame for each tag, every frame that allocated, and
+ * the arenas' sizes */
+void printAllocStats (FILE* out);
+
+#endif
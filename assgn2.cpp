@@ -2,6 +2,12 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include <stdlib.h>
 #include <string.h>
 #include <GL/glew.h>
@@ -13,116 +19,90 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-using namespace std;
-
-struct VAO {
-  GLuint VertexArrayID;
-  GLuint VertexBuffer;
-  GLuint ColorBuffer;
+#include "mesh.h"
+#include "level.h"
+#include "block.h"
+#include "solver.h"
+#include "replay.h"
+#include "offscreen.h"
+#include "profiler.h"
+#include "generator.h"
+#include "frustum.h"
+#include "shader.h"
+#include "loader.h"
+#include "transforms.h"
+#include "input.h"
+#include "entities.h"
+#include "debris.h"
+#include "camera.h"
+#include "jobs.h"
+#include "alloc.h"
+#include "glstate.h"
+#include "render.h"
 
-  GLenum PrimitiveMode;
-  GLenum FillMode;
-  int NumVertices;
-};
-typedef struct VAO VAO;
+using namespace std;
 
 struct GLMatrices {
   glm::mat4 projection;
   glm::mat4 model;
   glm::mat4 view;
-  GLuint MatrixID;
 } Matrices;
 
 int do_rot, floor_rel;;
-GLuint programID;
+GLuint programID, instancedProgramID;
+/* How the floor is drawn: merged chunk meshes, instanced chunks, or one
+ * call per tile */
+enum TileMode { TILES_MERGED, TILES_INSTANCED, TILES_PER_TILE };
+const char* tile_mode_names[] = { "merged", "instanced", "per-tile" };
+int tile_mode = TILES_MERGED;
+bool split_screen = false;
+int swap_interval = 1;
 double last_update_time, current_time;
-glm::vec3 rect_pos, floor_pos, rot_vector;
-
-
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
-
-    // Create the shaders
-  GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-  GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Read the Vertex Shader code from the file
-  std::string VertexShaderCode;
-  std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-  if(VertexShaderStream.is_open())
-  {
-   std::string Line = "";
-   while(getline(VertexShaderStream, Line))
-    VertexShaderCode += "\n" + Line;
-  VertexShaderStream.close();
-}
-
-    // Read the Fragment Shader code from the file
-std::string FragmentShaderCode;
-std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-if(FragmentShaderStream.is_open()){
- std::string Line = "";
- while(getline(FragmentShaderStream, Line))
-   FragmentShaderCode += "\n" + Line;
- FragmentShaderStream.close();
+glm::vec3 rect_pos, floor_pos;
+Level current_level;
+Level loading_level;
+/* The block is drawn once the level is there, and moves are taken once
+ * every chunk is */
+bool level_ready = false;
+bool level_streaming = false;
+chrono::steady_clock::time_point launch_time = chrono::steady_clock::now();
+
+/* World position of the centre of grid cell (i,j); tiles are 0.5 wide
+ * and the grid is centred on the origin */
+glm::vec3 cellPosition (float i, float j)
+{
+  return glm::vec3((i-(current_level.width-1)/2.0f)/2, 0, (j-(current_level.depth-1)/2.0f)/2);
 }
 
-GLint Result = GL_FALSE;
-int InfoLogLength;
-
-    // Compile Vertex Shader
-    //    printf("Compiling shader : %s\n", vertex_file_path);
-char const * VertexSourcePointer = VertexShaderCode.c_str();
-glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-glCompileShader(VertexShaderID);
-
-    // Check Vertex Shader
-glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-    //    fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
-
-    // Compile Fragment Shader
-    //    printf("Compiling shader : %s\n", fragment_file_path);
-char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-glCompileShader(FragmentShaderID);
-
-    // Check Fragment Shader
-glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-    //    fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
-
-    // Link the program
-    //    fprintf(stdout, "Linking program\n");
-GLuint ProgramID = glCreateProgram();
-glAttachShader(ProgramID, VertexShaderID);
-glAttachShader(ProgramID, FragmentShaderID);
-glLinkProgram(ProgramID);
-
-    // Check the program
-glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-    //    fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
-
-glDeleteShader(VertexShaderID);
-glDeleteShader(FragmentShaderID);
-
-return ProgramID;
-}
 
 static void error_callback(int error, const char* description)
 {
   fprintf(stderr, "Error: %s\n", description);
 }
 
+const char* trace_path;
+
+/* Write out the profiler's events, if a trace was asked for */
+void writeTrace()
+{
+  if (trace_path && profilerEnabled())
+  {
+    profilerFlushGPU();
+    profilerWriteTrace(trace_path);
+  }
+}
+
+void stopBestSolve ();
+
 void quit(GLFWwindow *window)
 {
+  stopBestSolve();
+  loaderStop();
+  jobsStop();
+  closeInputLog();
+  writeTrace();
+  if(allocTrackingEnabled())
+    printAllocStats(stderr);
   glfwDestroyWindow(window);
   glfwTerminate();
   exit(EXIT_SUCCESS);
@@ -139,82 +119,6 @@ void initGLEW(void){
 
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
-{
-  struct VAO* vao = new struct VAO;
-  vao->PrimitiveMode = primitive_mode;
-  vao->NumVertices = numVertices;
-  vao->FillMode = fill_mode;
-
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    return vao;
-  }
-
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-  struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
-  {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-      color_buffer_data [3*i] = red;
-      color_buffer_data [3*i + 1] = green;
-      color_buffer_data [3*i + 2] = blue;
-    }
-
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
-  }
-
-/* Render the VBOs handled by VAO */
-  void draw3DObject (struct VAO* vao)
-  {
-    // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
-
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
-
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
-
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
-  }
-
 /**************************
  * Customizable functions *
  **************************/
@@ -227,16 +131,282 @@ void gameover()
  float rectangle_rot_dir = 1;
  int distance = 3;
  bool rectangle_rot_status = true;
- float flag = 1;
  double last_time, curr_time;
- int rectangle_rotation = 0;
  int view_var=0;
- string dir;
+ BlockState block;
+ BlockStatus block_status = BLOCK_OK;
  glm::vec3 cameraPos4 = glm::vec3(0,0,3);
  glm::vec3 cameraTarget4 = glm::vec3(0.0f,0.0f,-1.0f); 
  glm::vec3 cameraUp4 = glm::vec3(0.0f, 1.0f,  0.0f);
  float cameraSpeed=0.5,phi=0,theta=0;
  int moves=0;
+/* The five cameras (camera n is cameras[n-1]), each rebuilt only when it
+ * moves. The space-bar camera is drawn through active_camera, which eases
+ * from where the view was when space was pressed to the new camera over
+ * CAMERA_BLEND_TIME seconds. */
+ Camera cameras[5];
+ Camera active_camera;
+ CameraLook blend_from;
+ float camera_blend = 1;
+#define CAMERA_BLEND_TIME 0.4f
+#define CAMERA_ACTIVE 0   // View.camera of the space-bar camera
+
+/* The simulation runs in fixed ticks of SIM_DT seconds whatever the frame
+ * rate; rendering blends between the last two ticks */
+#define SIM_DT (1.0/120.0)
+#define ROLL_TIME 0.15f  // seconds per roll
+#define GRAVITY 20.0f    // for falling, in world units per second squared
+
+ vector<Move> pending_moves;
+ double sim_accumulator = 0;
+ Debris debris;  // fragments of collapsed tiles, simulated with the block
+
+/* Input events are queued by the GLFW callbacks and applied at the start
+ * of the next tick, stamped with that tick, so a recorded session plays
+ * back identically. While replaying, events come from the log instead. */
+ vector<InputEvent> input_queue;
+ vector<InputEvent> replay_events;
+ size_t replay_next = 0;
+ const char* record_path = NULL;
+ bool recording = false;
+ bool replaying = false;
+ unsigned long long replay_level_hash;
+ unsigned int sim_tick = 0;
+
+ void collapseTile (int x, int z);
+ void applyInput (const InputEvent& event);
+
+/* Visual state of the block, advanced only in simulation ticks */
+ struct BlockAnimation {
+  bool rolling;
+  BlockState from;          // pose the current roll started from
+  Move move;
+  float t, prev_t;          // roll progress (0..1) at this tick and the last
+  float depth, prev_depth;  // how far the block has dropped
+  float speed;
+ } anim;
+
+ glm::mat4 block_model;
+
+/* Model matrix of the block at rest in state s. The cuboid is modelled
+ * lying along z: standing turns it about x, lying along x about y. */
+ glm::mat4 restingModel (BlockState s)
+ {
+  if(s.orient==ORIENT_STANDING)
+    return glm::translate(cellPosition(s.x, s.z) + glm::vec3(0,0.25,0)) * glm::rotate((float)(M_PI/2), glm::vec3(1,0,0));
+  if(s.orient==ORIENT_LYING_X)
+    return glm::translate(cellPosition(s.x+0.5f, s.z)) * glm::rotate((float)(M_PI/2), glm::vec3(0,1,0));
+  return glm::translate(cellPosition(s.x, s.z+0.5f));
+ }
+
+/* Model matrix of the block a fraction t through rolling m from state s.
+ * It tips over the bottom edge on the side it is rolling towards. */
+ glm::mat4 rollingModel (BlockState s, Move m, float t)
+ {
+  int sx = s.orient==ORIENT_LYING_X ? 2 : 1;
+  int sz = s.orient==ORIENT_LYING_Z ? 2 : 1;
+  glm::vec3 lo = cellPosition(s.x, s.z) - glm::vec3(0.25f, 0.25f, 0.25f);
+  glm::vec3 hi = cellPosition(s.x+sx-1, s.z+sz-1) + glm::vec3(0.25f, 0, 0.25f);
+  glm::vec3 pivot, axis;
+  float angle = t*M_PI/2;
+
+  switch(m)
+  {
+    case MOVE_UP:
+    pivot = glm::vec3(0, lo.y, hi.z);
+    axis = glm::vec3(1,0,0);
+    break;
+    case MOVE_DOWN:
+    pivot = glm::vec3(0, lo.y, lo.z);
+    axis = glm::vec3(1,0,0);
+    angle = -angle;
+    break;
+    case MOVE_LEFT:
+    pivot = glm::vec3(hi.x, lo.y, 0);
+    axis = glm::vec3(0,0,1);
+    angle = -angle;
+    break;
+    default:
+    pivot = glm::vec3(lo.x, lo.y, 0);
+    axis = glm::vec3(0,0,1);
+    break;
+  }
+  return glm::translate(pivot) * glm::rotate(angle, axis) * glm::translate(-pivot) * restingModel(s);
+ }
+
+/* Fewest moves that win the level as it was loaded, or -1 while that is
+ * not known: still solving, too big to solve, or unsolvable */
+ int best_moves = -1;
+/* The solver keeps about 3 bytes per cell; bigger levels are not solved */
+#define BEST_SOLVE_MAX_CELLS (16 << 20)
+
+/* Optimal move count of a level before any tile has collapsed */
+ int solveBest (const Level& level, int threads, const std::atomic<bool>* cancel=NULL)
+ {
+  if((long long)level.width*level.depth > BEST_SOLVE_MAX_CELLS)
+    return -1;
+  SolveResult best = solveLevel(level, threads, cancel);
+  return best.solved ? (int)best.moves.size() : -1;
+ }
+
+/* The windowed and --bench runs solve on a thread of their own, so that
+ * neither the loader threads nor quitting wait for it */
+ std::thread best_solver;
+ std::atomic<bool> best_solve_cancel(false);
+
+/* Give up a running solve and wait for its thread */
+ void stopBestSolve ()
+ {
+  if(!best_solver.joinable())
+    return;
+  best_solve_cancel=true;
+  best_solver.join();
+ }
+
+/* Solve a fresh copy of the level file, since tiles collapse in the
+ * played one, and hand the result to the main thread */
+ void startBestSolve (const char* path)
+ {
+  stopBestSolve();
+  best_moves=-1;
+  best_solve_cancel=false;
+  best_solver = std::thread([path] () {
+    Level pristine;
+    int best = loadLevel(path, pristine) ? solveBest(pristine, 1, &best_solve_cancel) : -1;
+    if(!best_solve_cancel)
+      loaderUpload([best] () { best_moves=best; });
+  });
+ }
+
+/* Apply one move to the simulation; ignored once the block has fallen */
+ void moveBlock (Move m)
+ {
+  if(block_status!=BLOCK_OK)
+    return;
+  block_status=stepBlock(current_level, block, m);
+  moves+=1;
+  if(block_status==BLOCK_WON)
+  {
+    cout<<"Level complete in "<<moves<<" moves (best possible: ";
+    if(best_moves>=0)
+      cout<<best_moves;
+    else
+      cout<<"unknown";
+    cout<<")"<<endl;
+  }
+ }
+
+/* Keys only queue moves; the next simulation tick applies them */
+ void queueMove (Move m)
+ {
+  if(level_streaming)
+    return;
+  pending_moves.push_back(m);
+ }
+
+/* One fixed simulation step */
+ void simulateTick (float dt)
+ {
+  anim.prev_t = anim.t;
+  anim.prev_depth = anim.depth;
+  if(anim.rolling && anim.prev_t>=1)
+    anim.rolling = false;
+
+  // A new move cuts any roll still in progress short
+  for(unsigned int n=0;n<pending_moves.size() && block_status==BLOCK_OK;n++)
+  {
+    anim.from = block;
+    anim.move = pending_moves[n];
+    anim.rolling = true;
+    anim.t = anim.prev_t = 0;
+    moveBlock(pending_moves[n]);
+  }
+  pending_moves.clear();
+
+  updateDebris(debris, dt, GRAVITY);
+  camera_blend = min(1.0f, camera_blend + dt/CAMERA_BLEND_TIME);
+
+  // The block only drops once it has finished rolling off the edge
+  if(anim.rolling)
+    anim.t = min(1.0f, anim.t + dt/ROLL_TIME);
+  else if(block_status!=BLOCK_OK)
+  {
+    // A breakable tile gives way under the block as it starts to drop
+    if(anim.depth==0 && block.orient==ORIENT_STANDING && levelTile(current_level, block.x, block.z)==TILE_BREAKABLE)
+      collapseTile(block.x, block.z);
+    anim.speed += GRAVITY*dt;
+    anim.depth += anim.speed*dt;
+  }
+ }
+
+/* Block pose to draw, blended between the last two ticks by alpha (0..1) */
+ void updateBlockRender (float alpha)
+ {
+  glm::mat4 model;
+  if(anim.rolling)
+    model = rollingModel(anim.from, anim.move, anim.prev_t + (anim.t - anim.prev_t)*alpha);
+  else
+    model = restingModel(block);
+  float depth = anim.prev_depth + (anim.depth - anim.prev_depth)*alpha;
+  block_model = glm::translate(glm::vec3(0, -depth, 0)) * model;
+  rect_pos = glm::vec3(block_model[3].x, block_model[3].y, block_model[3].z);
+ }
+
+/* Queue an event from a GLFW callback for the next tick */
+ void queueInput (InputEventType type, int code, int action)
+ {
+  InputEvent event;
+  event.tick = 0;
+  event.type = type;
+  event.action = action;
+  event.code = code;
+  input_queue.push_back(event);
+ }
+
+/* Apply the input due at this tick: queued events (stamped and logged),
+ * or the log's events when replaying */
+ void processInput ()
+ {
+  if(replaying)
+  {
+    for(;replay_next<replay_events.size() && replay_events[replay_next].tick<=sim_tick;replay_next++)
+      applyInput(replay_events[replay_next]);
+    input_queue.clear();
+    return;
+  }
+  for(unsigned int n=0;n<input_queue.size();n++)
+  {
+    input_queue[n].tick = sim_tick;
+    if(recording)
+      writeInputEvent(input_queue[n]);
+    applyInput(input_queue[n]);
+  }
+  input_queue.clear();
+ }
+
+ void runTick ()
+ {
+  processInput();
+  simulateTick(SIM_DT);
+  sim_tick++;
+ }
+
+/* Run as many fixed ticks as 'elapsed' seconds of real time cover and
+ * pose the block for rendering. Long stalls are capped so the game
+ * pauses instead of fast-forwarding. Time only starts once the level
+ * has fully streamed in, so tick numbers mean the same in every run. */
+ void advanceSimulation (double elapsed)
+ {
+  if(level_streaming)
+    return;
+  sim_accumulator += min(elapsed, 0.25);
+  while(sim_accumulator >= SIM_DT)
+  {
+    runTick();
+    sim_accumulator -= SIM_DT;
+  }
+  updateBlockRender(sim_accumulator / SIM_DT);
+ }
  //cameraPos4.x = distance * (float)Math.Sin(phi) * (float)Math.Sin(theta);
  //cameraPos4.y = distance * (float)Math.Sin(phi) * (float)Math.Cos(theta);
  //cameraPos4.z = distance * (float)Math.Cos(phi);
@@ -246,120 +416,42 @@ void gameover()
  void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
  {
     // Function is called first on GLFW_PRESS.
-  int i;
-  if (action == GLFW_RELEASE) {
-    switch (key) {
+    // Escape quits at once; everything else waits for the next tick
+  if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE)
+    quit(window);
+  else
+    queueInput(INPUT_KEY, key, action);
+ }
+
+/* Apply one key or mouse event to the game */
+ void applyInput (const InputEvent& event)
+ {
+  if (event.type == INPUT_MOUSE) {
+    if (event.code == GLFW_MOUSE_BUTTON_RIGHT && event.action == GLFW_RELEASE)
+      rectangle_rot_dir *= -1;
+    return;
+  }
+  if (event.action == GLFW_RELEASE) {
+    switch (event.code) {
 
      case GLFW_KEY_UP:
-     if(dir=="oy")
-     {
-      rect_pos.y=0;
-      rect_pos.z+=0.75;
-      rectangle_rotation=0;
-      flag=0;
-      dir="oz";
-      moves+=1;
-    }
-    else if(dir=="oz")
-    {
-      flag=0;
-      rectangle_rotation=90;
-      rect_pos.z+=0.75;
-      rect_pos.y=0.25;
-      dir="oy";
-      moves+=1;
-    }
-    else if(dir=="ox")
-    {
-      rect_pos.z+=0.5;
-      dir="ox";
-      moves+=1;
-    }
-    break;
-    
-    case GLFW_KEY_DOWN:
-    if(dir=="oy")
-    {
-      flag=0;
-      rectangle_rotation=0;
-      rect_pos.z-=0.75;
-      rect_pos.y=0;
-      dir="oz";
-      moves+=1;
-    }
-    else if(dir=="oz")
-    {
-      flag=0;
-      rectangle_rotation=90;
-      rect_pos.z-=0.75;
-      rect_pos.y=0.25;
-      dir="oy";
-      moves+=1;
-    }
-    else if(dir=="ox")
-    {
-      rect_pos.z-=0.5;
-      dir="ox";
-      moves+=1;
-    }
-    break;
-    
-    case GLFW_KEY_LEFT:
-    if(dir=="oy")
-    {
-      flag=2;
-      rectangle_rotation=90;
-      rect_pos.x+=0.75;
-      rect_pos.y=0;
-      dir="ox";
-      moves+=1;
-    }
-    else if(dir=="oz")
-    {
-      rect_pos.x+=0.5;
-      dir="oz";
-      moves+=1;
-    }
-    else if(dir=="ox")
-    {
-      flag=0;
-      rectangle_rotation=90;
-      rect_pos.x+=0.75;
-      rect_pos.y=0.25;
-      dir="oy";
-      moves+=1;
-    }
-    break;
-    
-    case GLFW_KEY_RIGHT:
-    if(dir=="oy")
-    {
-      flag=2;
-      rectangle_rotation=90;
-      rect_pos.x-=0.75;
-      rect_pos.y=0;
-      dir="ox";
-      moves+=1;
-    }
-    else if(dir=="oz")
-    {
-      rect_pos.x-=0.5;
-      dir="oz";
-      moves+=1;
-    }
-    else if(dir=="ox")
-    {
-      flag=0;
-      rectangle_rotation=90;
-      rect_pos.x-=0.75;
-      rect_pos.y=0.25;
-      dir="oy";
-      moves+=1;
-    }
-    break;
+     queueMove(MOVE_UP);
+     break;
+     case GLFW_KEY_DOWN:
+     queueMove(MOVE_DOWN);
+     break;
+     case GLFW_KEY_LEFT:
+     queueMove(MOVE_LEFT);
+     break;
+     case GLFW_KEY_RIGHT:
+     queueMove(MOVE_RIGHT);
+     break;
     
     case GLFW_KEY_SPACE:
+    blend_from=active_camera.look;
+    camera_blend=0;
     view_var=(view_var+1)%5;
+    break;
     
     case GLFW_KEY_W:
     cameraPos4 += cameraSpeed * cameraTarget4;
@@ -373,6 +465,34 @@ void gameover()
     case GLFW_KEY_D:
     cameraPos4 += glm::normalize(glm::cross(cameraTarget4, cameraUp4)) * cameraSpeed; 
     break;
+    case GLFW_KEY_I:
+    tile_mode = (tile_mode+1)%3;
+    break;
+    case GLFW_KEY_M:
+    printMeshRegistry(stdout);
+    break;
+    case GLFW_KEY_V:
+    split_screen = !split_screen;
+    break;
+    case GLFW_KEY_K:
+    // Stress test: every breakable tile gives way at once
+    for(int j=0;j<current_level.depth;j++)
+      for(int i=0;i<current_level.width;i++)
+        if(levelTile(current_level,i,j)==TILE_BREAKABLE)
+          collapseTile(i,j);
+    break;
+    case GLFW_KEY_P:
+    // First press starts capturing, the second writes the capture out
+    if (!profilerEnabled())
+      profilerEnable(true);
+    else
+    {
+      profilerFlushGPU();
+      profilerWriteTrace("blockards_trace.json");
+      profilerWriteTrace("blockards_trace.csv");
+      profilerEnable(false);
+    }
+    break;
     /*case GLFW_KEY_R:
         phi+=5.0f;
     break;
@@ -385,15 +505,6 @@ void gameover()
   //cout<<view_var<<endl;
   // cout<<rectangle_rotation<<endl;
     }
-    else if (action == GLFW_PRESS) {
-      switch (key) {
-       case GLFW_KEY_ESCAPE:
-       quit(window);
-       break;
-       default:
-       break;
-     }
-   }
  }
 /* Executed for character input (like in text boxes) */
  void keyboardChar (GLFWwindow* window, unsigned int key)
@@ -411,39 +522,85 @@ void gameover()
 /* Executed when a mouse button is pressed/released */
 void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
-  switch (button) {
-    case GLFW_MOUSE_BUTTON_RIGHT:
-    if (action == GLFW_RELEASE) {
-     rectangle_rot_dir *= -1;
-   }
-   break;
-   default:
-   break;
- }
+  queueInput(INPUT_MOUSE, button, action);
 }
 
 
+int fb_width, fb_height;
+void resizeFramebuffer (int fbwidth, int fbheight);
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
   int fbwidth=width, fbheight=height;
   glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+  resizeFramebuffer(fbwidth, fbheight);
+}
 
+/* Size of the framebuffer being drawn to - the window or the offscreen target */
+void resizeFramebuffer (int fbwidth, int fbheight)
+{
   GLfloat fov = M_PI/2;
+  int c;
+  fb_width = fbwidth;
+  fb_height = fbheight;
 
     // sets the viewport of openGL renderer
-  glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+  setViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
 
-    // Store the projection matrix in a variable for future use
-    // Perspective projection for 3D views
-  Matrices.projection = glm::perspective(fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
+    // Perspective projection for 3D views; split-screen quarters keep the
+    // framebuffer's aspect, so every camera shares one lens
+  for(c=0;c<5;c++)
+    setCameraLens(cameras[c], fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
+  setCameraLens(active_camera, fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
     // Ortho projection for 2D views
     // Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
 }
 
-VAO *rectangle, *tiles[10][10], *Breaktiles[10][10];
+VAO *rectangle, *floorTile, *breakTile;
+
+/* Grid cell of one placed tile and its offset from floor_pos */
+struct TilePlacement {
+  int i, j;
+  glm::vec3 pos;
+};
+/* The level split into CHUNK_SIZE x CHUNK_SIZE cell chunks. A chunk
+ * keeps its tiles, a bounding box to cull it against each view, its own
+ * instance buffers, and all its tiles merged into one static mesh. When
+ * a tile breaks only its chunk is marked dirty and rebuilt. */
+#define CHUNK_SIZE 32
+enum ChunkState { CHUNK_LOADING, CHUNK_RESIDENT };
+struct ChunkBounds {
+  int x0, z0, x1, z1;  // cells [x0,x1) x [z0,z1)
+  glm::vec3 lo, hi;
+};
+struct TileChunk : ChunkBounds {
+  std::vector<TilePlacement> floor, breakable;
+  EntityStore entities;  // breakable tiles then floor tiles, for per-tile drawing
+  InstancedVAO *floorInstances, *breakInstances;
+  VAO* mesh;
+  bool dirty;
+  int state;
+  unsigned int ticket;   // the load job whose result the chunk is waiting for
+  size_t bytes;          // CPU and GPU memory held while resident
+  unsigned int visible;  // bit v set when view v sees it this frame
+};
+/* Only chunks near the block and the cameras are kept, keyed by
+ * chunk row * chunks_x + chunk column; the rest of the level stays in
+ * the mapped file. The records live in level_arena; evicted ones wait in
+ * spare_chunks, GPU objects and all, for the next chunk to load. */
+std::unordered_map<int, TileChunk*> tile_chunks;
+std::vector<TileChunk*> spare_chunks;
+int chunks_x, chunks_z;  // chunks per row and column of the level
+/* Chunks within stream_radius world units of the block or a camera are
+ * loaded, nearest first, while their memory stays under stream_budget */
+float stream_radius = 48;
+size_t stream_budget = 256u << 20;
+size_t stream_bytes = 0;          // held by resident chunks
+unsigned int stream_tickets = 0;
+int stream_loads = 0, stream_evictions = 0;
 
 // Creates the rectangle object used in this sample code
 void createRectangle ()
@@ -528,7 +685,7 @@ void createRectangle ()
  };
 
     // create3DObject creates and returns a handle to a VAO that can be used later
- rectangle = create3DObject(GL_TRIANGLES, 13*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+ rectangle = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 /*void createCam ()
 {
@@ -548,271 +705,788 @@ void createRectangle ()
     // create3DObject creates and returns a handle to a VAO that can be used later
     cam = create3DObject(GL_TRIANGLES, 1*3, vertex_buffer_data, color_buffer_data, GL_LINE);
 }*/
+/* A tile is one flat quad; floor and breakable tiles differ in color */
+static const GLfloat tile_vertex_data [] = {
+  -0.25, -0.25, 0.25,
+  0.25, -0.25, 0.25,
+  -0.25, -0.25, -0.25,
+  -0.25, -0.25, -0.25,
+  0.25, -0.25, 0.25,
+  0.25, -0.25, -0.25,
+};
+
+static const GLfloat floor_color_data [] = {
+  0.82, 0.82, 0.82,
+  0.65, 0.65, 0.65,
+  0.6, 0.6, 0.8,
+  0.6, 0.6, 0.8,
+  0.65, 0.65, 0.65,
+  0.23, 0.32, 0.32,
+};
+
+static const GLfloat break_color_data [] = {
+  0.85, 0.85, 0,
+  1, 0.9, 0,
+  0.8, 0.39, 0,
+  0.8, 0.39, 0,
+  1, 0.9, 0,
+  1, 1, 1,
+};
+
     void createFloor ()
     {
-      int i,j;
     // GL3 accepts only Triangles. Quads are not supported
-      static const GLfloat vertex_buffer_data [] = {
-       -0.25, -0.25, 0.25,
-       0.25, -0.25, 0.25, 
-       -0.25, -0.25, -0.25,
-       -0.25, -0.25, -0.25,
-       0.25, -0.25, 0.25, 
-       0.25, -0.25, -0.25,
-     };
-
-     static const GLfloat color_buffer_data [] = {
-       0.82, 0.82, 0.82,
-       0.65, 0.65, 0.65,
-       0.6, 0.6, 0.8,
-       0.6, 0.6, 0.8,
-       0.65, 0.65, 0.65,
-       0.23, 0.32, 0.32,
-     };
-
     // create3DObject creates and returns a handle to a VAO that can be used later
-     for(i=0;i<10;i++)
-     {
-      for (j=0;j<10;j++)
-       tiles[i][j] = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-   }
+     floorTile = create3DObject(GL_TRIANGLES, 2*3, tile_vertex_data, floor_color_data, GL_FILL);
  }
 
 void createBreakableTiles ()
     {
-      int i,j;
     // GL3 accepts only Triangles. Quads are not supported
-      static const GLfloat vertex_buffer_data [] = {
-       -0.25, -0.25, 0.25,
-       0.25, -0.25, 0.25, 
-       -0.25, -0.25, -0.25,
-       -0.25, -0.25, -0.25,
-       0.25, -0.25, 0.25, 
-       0.25, -0.25, -0.25,
-     };
-
-     static const GLfloat color_buffer_data [] = {
-       0.85, 0.85, 0,
-       1, 0.9, 0,
-       0.8, 0.39, 0,
-       0.8, 0.39, 0,
-       1, 0.9, 0,
-       1, 1, 1,
-     };
-
     // create3DObject creates and returns a handle to a VAO that can be used later
-     for(i=0;i<10;i++)
-     {
-      for (j=0;j<10;j++)
-       Breaktiles[i][j] = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-   }
+     breakTile = create3DObject(GL_TRIANGLES, 2*3, tile_vertex_data, break_color_data, GL_FILL);
  }
 
- float camera_rotation_angle = 225;
- int level=1;
- int falling=0;
- //int tileFalling=0;
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
- void draw (GLFWwindow* window, float x, float y, float w, float h, int doM, int doV, int doP)
- {
-  int fbwidth, fbheight;
-  glfwGetFramebufferSize(window, &fbwidth, &fbheight);
-  glViewport((int)(x*fbwidth), (int)(y*fbheight), (int)(w*fbwidth), (int)(h*fbheight));
-  if(flag==0)
-  {
-    rot_vector = glm::vec3(1,0,0);
-  }
-  else if(flag==1)
-  {
-    rot_vector = glm::vec3(0,0,1);
-  }
-  else if(flag==2)
-    rot_vector = glm::vec3(0,1,0);
-
-    // use the loaded shader program
-    // Don't change unless you know what you are doing
-  glUseProgram(programID);
-
-    // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 3, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-    // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-    // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
-
-  glm::vec3 cameraPos = rect_pos + glm::vec3(0.0f,0.0f,0.5f);
-  glm::vec3 cameraTarget = rect_pos + glm::vec3(0.0f,0.0f,1.0f);
-  glm::vec3 up2 = glm::vec3(0,0,1);
-  glm::vec3 cameraPos2 = glm::vec3(0.0f,7.0f,0.0f);
-  glm::vec3 cameraTarget2 = glm::vec3(0.0f,0.0f,0.0f);
-  glm::vec3 cameraPos3 = rect_pos - glm::vec3(0.0f,0.0f,2.0f);
-  glm::vec3 cameraTarget3 = rect_pos;
-  
-    // Compute Camera matrix (view)
-    if(doV==1) //tower view
-  Matrices.view = glm::lookAt(eye, target, up); // Fixed camera for 2D (ortho) in XY plane
-    else if(doV==2) // follow cam
-      Matrices.view = glm::lookAt(cameraPos, cameraTarget, up);
-    else if(doV==3)
-      Matrices.view = glm::lookAt(cameraPos2,cameraTarget2, up2);
-    else if(doV==4)
-      Matrices.view = glm::lookAt(cameraPos3,cameraTarget3, up);
-    else if(doV==5)
-      Matrices.view = glm::lookAt(cameraPos4, cameraTarget4 + cameraPos4, cameraUp4);
-    else 
-     Matrices.view = glm::mat4(1.0f);
-
-    // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-   glm::mat4 VP;
-   VP = Matrices.projection * Matrices.view;
-
-    // Send our transformation to the currently bound shader, in the "MVP" uniform
-    // For each model you render, since the MVP will be different (at least the M part)
-    glm::mat4 MVP;  // MVP = Projection * View * Model
-
-    // Load identity to model matrix
-/*if(rectangle_rotation%180!=0)
+/* Fragments of collapsed tiles are drawn as one instanced batch of small cubes */
+VAO* debrisPiece;
+InstancedVAO* debrisBatch;
+std::vector<TileInstance> debris_instances;
+
+/* A cube of side 0.5/DEBRIS_SPLIT, its faces shaded so fragments read as solid */
+void createDebris ()
+{
+  static const int faces[6][4][3] = {
+    {{0,0,1},{1,0,1},{1,1,1},{0,1,1}}, {{1,0,0},{0,0,0},{0,1,0},{1,1,0}},
+    {{0,1,1},{1,1,1},{1,1,0},{0,1,0}}, {{0,0,0},{1,0,0},{1,0,1},{0,0,1}},
+    {{1,0,1},{1,0,0},{1,1,0},{1,1,1}}, {{0,0,0},{0,0,1},{0,1,1},{0,1,0}}
+  };
+  static const float shades[6] = { 0.9f, 0.6f, 1.0f, 0.5f, 0.8f, 0.7f };
+  static const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+  GLfloat vertex_buffer_data[6*6*3], color_buffer_data[6*6*3];
+  float half = 0.25f/DEBRIS_SPLIT;
+  int f,k,a;
+
+  for(f=0;f<6;f++)
+    for(k=0;k<6;k++)
+      for(a=0;a<3;a++)
+      {
+        vertex_buffer_data[(f*6+k)*3+a] = faces[f][corners[k]][a] ? half : -half;
+        color_buffer_data[(f*6+k)*3+a] = shades[f];
+      }
+  debrisPiece = create3DObject(GL_TRIANGLES, 6*6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  debrisBatch = createInstancedObject(debrisPiece, std::vector<TileInstance>());
+}
+
+/* The CPU side of building a chunk, which loader threads can do. The
+ * chunk's cells are copied in on the main thread first, so a build never
+ * reads the level while a tile collapses. */
+struct ChunkData {
+  std::vector<unsigned char> cells;  // row-major over the chunk's cells
+  std::vector<TilePlacement> floor, breakable;
+  EntityStore entities;
+  std::vector<TileInstance> floor_instances, break_instances;
+  MeshData mesh;
+};
+
+/* Copy a chunk's cells out of current_level; main thread only */
+void copyChunkCells (const ChunkBounds& chunk, ChunkData& data)
 {
-  rect_pos.y=0.25;
+  int w=chunk.x1-chunk.x0;
+  data.cells.resize((size_t)w*(chunk.z1-chunk.z0));
+  for(int j=chunk.z0;j<chunk.z1;j++)
+    for(int i=chunk.x0;i<chunk.x1;i++)
+      data.cells[(size_t)(j-chunk.z0)*w+(i-chunk.x0)]=levelTile(current_level,i,j);
 }
-else rect_pos.y=0;*/
-Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translateRectangle = glm::translate (rect_pos);        // glTranslatef
-    glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), rot_vector);
-    
-    Matrices.model *= (translateRectangle * rotateRectangle);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(rectangle);
-
-    // Load identity to model matrix
-    /*Matrices.model = glm::mat4(1.0f);
-
-    glm::mat4 translateCam = glm::translate(eye);
-    glm::mat4 rotateCam = glm::rotate((float)((90 - camera_rotation_angle)*M_PI/180.0f), glm::vec3(0,1,0));
-    Matrices.model *= (translateCam * rotateCam);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(cam);*/
-    int k,l;
-    glm::vec3 Btile;
-    for (k=0;k<3;k++)
+
+/* Collect a chunk's tiles from its copied cells into instance lists and
+ * merged mesh data. Safe on any thread. */
+void buildChunkData (const ChunkBounds& chunk, ChunkData& data)
+{
+  int i,j;
+  TilePlacement t;
+  TileInstance inst;
+
+  inst.color=glm::vec3(1,1,1);
+  // Half-float positions only hold the tile grid exactly within 512 units of the origin
+  if(max(max(fabs(chunk.lo.x),fabs(chunk.hi.x)),max(fabs(chunk.lo.z),fabs(chunk.hi.z)))>512)
+    data.mesh.layout=&LAYOUT_FLOAT;
+  const unsigned char* cell=&data.cells[0];
+  for(j=chunk.z0;j<chunk.z1;j++)
+  {
+    for(i=chunk.x0;i<chunk.x1;i++,cell++)
     {
-      for(l=0;l<2;l++)
+      t.i=i; t.j=j;
+      t.pos=cellPosition(i,j);
+      inst.offset=floor_pos+t.pos;
+      if(*cell==TILE_SOLID)
       {
-Btile=glm::vec3((3.5-k)/2,0,(2.5-l)/2);
-    Matrices.model = glm::translate(floor_pos+Btile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(Breaktiles[k][l]);
+        data.floor.push_back(t);
+        data.floor_instances.push_back(inst);
+        appendVertices(data.mesh, 6, tile_vertex_data, floor_color_data, inst.offset);
       }
-      if(rect_pos.z> 0.25 && rect_pos.x==Btile.x && rect_pos.x==Btile.z && dir=="oy")
+      else if(*cell==TILE_BREAKABLE)
+      {
+        data.breakable.push_back(t);
+        data.break_instances.push_back(inst);
+        appendVertices(data.mesh, 6, tile_vertex_data, break_color_data, inst.offset);
+      }
+    }
+  }
+  for(unsigned int n=0;n<data.break_instances.size();n++)
+    addEntity(data.entities, data.break_instances[n].offset);
+  for(unsigned int n=0;n<data.floor_instances.size();n++)
+    addEntity(data.entities, data.floor_instances[n].offset);
+}
+
+/* Hand built data to a chunk and its GPU objects, which are created on
+ * the first upload and refilled in place afterwards */
+void uploadChunk (TileChunk& chunk, ChunkData& data)
+{
+  chunk.floor.swap(data.floor);
+  chunk.breakable.swap(data.breakable);
+  std::swap(chunk.entities, data.entities);
+  if(chunk.floorInstances)
+    updateInstancedObject(chunk.floorInstances, data.floor_instances);
+  else
+    chunk.floorInstances = createInstancedObject(floorTile, data.floor_instances);
+  if(chunk.breakInstances)
+    updateInstancedObject(chunk.breakInstances, data.break_instances);
+  else
+    chunk.breakInstances = createInstancedObject(breakTile, data.break_instances);
+  if(chunk.mesh)
+    update3DObject(chunk.mesh, data.mesh);
+  else
+    chunk.mesh = createMutable3DObject(GL_TRIANGLES, data.mesh);
+  chunk.dirty=false;
+
+  stream_bytes -= chunk.bytes;
+  chunk.bytes = meshGPUBytes(chunk.mesh)
+    + (chunk.floorInstances->NumInstances + chunk.breakInstances->NumInstances)*sizeof(TileInstance)
+    + (chunk.floor.capacity() + chunk.breakable.capacity())*sizeof(TilePlacement)
+    + chunk.entities.size()*10*sizeof(float);
+  stream_bytes += chunk.bytes;
+}
+
+/* Rebuild a chunk right away, on the main thread */
+void buildChunk (TileChunk& chunk)
+{
+  ChunkData data;
+  copyChunkCells(chunk, data);
+  buildChunkData(chunk, data);
+  uploadChunk(chunk, data);
+}
+
+/* Cells and bounding box of the chunk in column cx, row cz */
+void setChunkBounds (ChunkBounds& chunk, int cx, int cz)
+{
+  chunk.x0=cx*CHUNK_SIZE;
+  chunk.z0=cz*CHUNK_SIZE;
+  chunk.x1=min(chunk.x0+CHUNK_SIZE,current_level.width);
+  chunk.z1=min(chunk.z0+CHUNK_SIZE,current_level.depth);
+  // Tiles are flat quads at y=-0.25 around their cell centre
+  chunk.lo=floor_pos+cellPosition(chunk.x0,chunk.z0)-glm::vec3(0.25f,0.25f,0.25f);
+  chunk.hi=floor_pos+cellPosition(chunk.x1-1,chunk.z1-1)+glm::vec3(0.25f,-0.25f,0.25f);
+}
+
+/* Drop a chunk, keeping its record and GPU objects for the next load;
+ * the buffers are emptied so that they hold no memory meanwhile */
+void evictChunk (int key)
+{
+  auto it = tile_chunks.find(key);
+  TileChunk& chunk = *it->second;
+  if(chunk.mesh)
+    update3DObject(chunk.mesh, MeshData());
+  if(chunk.floorInstances)
+    updateInstancedObject(chunk.floorInstances, std::vector<TileInstance>());
+  if(chunk.breakInstances)
+    updateInstancedObject(chunk.breakInstances, std::vector<TileInstance>());
+  std::vector<TilePlacement>().swap(chunk.floor);
+  std::vector<TilePlacement>().swap(chunk.breakable);
+  chunk.entities = EntityStore();
+  stream_bytes -= chunk.bytes;
+  chunk.bytes = 0;
+  spare_chunks.push_back(&chunk);
+  tile_chunks.erase(it);
+}
+
+/* Free the GPU objects of every chunk record and start level_arena over */
+void releaseChunks ()
+{
+  while(!tile_chunks.empty())
+    evictChunk(tile_chunks.begin()->first);
+  for(unsigned int n=0;n<spare_chunks.size();n++)
+  {
+    TileChunk* chunk = spare_chunks[n];
+    if(chunk->mesh)
+      release3DObject(chunk->mesh);
+    if(chunk->floorInstances)
+      releaseInstancedObject(chunk->floorInstances);
+    if(chunk->breakInstances)
+      releaseInstancedObject(chunk->breakInstances);
+    chunk->~TileChunk();
+  }
+  spare_chunks.clear();
+  arenaReset(level_arena);
+}
+
+/* Start building chunk 'key' on a loader thread. The chunk appears once
+ * its upload has run; if it was evicted or reloaded meanwhile the
+ * result is thrown away. */
+void loadChunk (int key)
+{
+  TileChunk* record;
+  if(!spare_chunks.empty())
+  {
+    record = spare_chunks.back();
+    spare_chunks.pop_back();
+  }
+  else
+  {
+    record = arenaNew<TileChunk>(level_arena);
+    record->floorInstances=record->breakInstances=NULL;
+    record->mesh=NULL;
+    record->bytes=0;
+  }
+  tile_chunks[key] = record;
+  TileChunk& chunk = *record;
+  setChunkBounds(chunk, key%chunks_x, key/chunks_x);
+  chunk.dirty=false;
+  chunk.state=CHUNK_LOADING;
+  chunk.ticket=++stream_tickets;
+  chunk.visible=0;
+  stream_loads++;
+
+  // Jobs get a copy of the bounds, since the record may be reused by the
+  // time they run, and of the cells, since tiles collapse meanwhile
+  ChunkBounds bounds=chunk;
+  unsigned int ticket=chunk.ticket;
+  std::shared_ptr<ChunkData> data(new ChunkData);
+  copyChunkCells(bounds, *data);
+  loaderSubmit([key, ticket, bounds, data] () {
+    buildChunkData(bounds, *data);
+    loaderUpload([key, ticket, data] () {
+      auto it = tile_chunks.find(key);
+      if(it==tile_chunks.end() || it->second->ticket!=ticket)
+        return;
+      // A tile that broke while the job ran leaves the chunk dirty
+      TileChunk& chunk = *it->second;
+      bool dirty=chunk.dirty;
+      uploadChunk(chunk, *data);
+      chunk.dirty=dirty;
+      chunk.state=CHUNK_RESIDENT;
+    });
+  });
+}
+
+void streamChunks (const glm::vec3* focus, int nfocus);
+Camera& viewCamera (int doV);
+
+/* Drop the previous level's chunks and load the ones around the start */
+void createTileChunks ()
+{
+  releaseChunks();
+  chunks_x=(current_level.width+CHUNK_SIZE-1)/CHUNK_SIZE;
+  chunks_z=(current_level.depth+CHUNK_SIZE-1)/CHUNK_SIZE;
+  glm::vec3 focus[2] = { rect_pos, viewCamera(CAMERA_ACTIVE).look.eye };
+  streamChunks(focus, 2);
+}
+
+/* Remove the tile at (x,z) from the level; its chunk is rebuilt before
+ * the next draw */
+void collapseTile (int x, int z)
+{
+  if(levelTile(current_level,x,z)==TILE_EMPTY)
+    return;
+  bool breakable = levelTile(current_level,x,z)==TILE_BREAKABLE;
+  setLevelTile(current_level,x,z,TILE_EMPTY);
+  spawnDebris(debris, floor_pos+cellPosition(x,z)-glm::vec3(0,0.25f,0), 0.5f,
+              breakable ? glm::vec3(0.95f,0.8f,0.1f) : glm::vec3(0.7f,0.7f,0.75f), (unsigned)z*current_level.width+x);
+  // Headless runs have no chunks, and chunks not loaded read the change
+  // from the level when they are
+  auto it = tile_chunks.find((z/CHUNK_SIZE)*chunks_x + x/CHUNK_SIZE);
+  if(it!=tile_chunks.end())
+    it->second->dirty=true;
+}
+
+/* Levels stream in: a loader thread reads the file into loading_level,
+ * then startLevel moves it into current_level on the main thread and
+ * queues the chunk builds */
+/* Put the block on the start of current_level; play, and any input
+ * recording, starts from here */
+void placeBlock ()
+{
+  block=startState(current_level);
+  block_status=checkBlock(current_level, block);
+  updateBlockRender(1);
+  level_ready=true;
+  if(replaying && replay_level_hash!=levelHash(current_level))
+    fprintf(stderr, "warning: the input log was recorded on a different level\n");
+  if(record_path)
+    recording=openInputLog(record_path, levelHash(current_level));
+}
+
+/* FNV-1a of the game state, to compare the end of two runs */
+unsigned long long sessionHash ()
+{
+  struct {
+    int x, z, orient, status, moves, view, split;
+    float depth, camera[3], rot_dir;
+  } state;
+  memset(&state, 0, sizeof(state));
+  state.x=block.x; state.z=block.z; state.orient=block.orient;
+  state.status=block_status; state.moves=moves;
+  state.view=view_var; state.split=split_screen;
+  state.depth=anim.depth;
+  state.camera[0]=cameraPos4.x; state.camera[1]=cameraPos4.y; state.camera[2]=cameraPos4.z;
+  state.rot_dir=rectangle_rot_dir;
+
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned char* bytes = (const unsigned char*) &state;
+  for(size_t i=0;i<sizeof(state);i++)
+  {
+    h ^= bytes[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void startLevel ()
+{
+  current_level = std::move(loading_level);
+  placeBlock();
+  createTileChunks();
+}
+
+void streamLevel (const char* path)
+{
+  level_ready=false;
+  level_streaming=true;
+  loaderSubmit([path] () {
+    if(!loadLevel(path, loading_level))
     {
-      falling=1;
-      Btile.y-=0.5;
+      loaderUpload([] () { stopBestSolve(); loaderStop(); jobsStop(); exit(EXIT_FAILURE); });
+      return;
     }
+    loaderUpload(startLevel);
+  });
+  // It may take a while, and play need not wait
+  startBestSolve(path);
+}
+
+/* Call once per frame: notes when streaming has finished */
+void checkStreaming (const char* path)
+{
+  if(level_streaming && loaderIdle())
+  {
+    level_streaming=false;
+    fprintf(stderr, "%s streamed in %.1f ms after launch\n", path, chrono::duration<double, milli>(chrono::steady_clock::now() - launch_time).count());
+  }
+}
+
+/* Rebuild chunks whose tiles changed - only those, so a collapse costs
+ * one chunk's worth of work rather than the whole level */
+void rebuildDirtyChunks ()
+{
+  for(auto it=tile_chunks.begin();it!=tile_chunks.end();++it)
+    if(it->second->dirty && it->second->state==CHUNK_RESIDENT)
+      buildChunk(*it->second);
+}
+
+ float camera_rotation_angle = 225;
+ int level=1;
+ //int tileFalling=0;
+
+/* A viewport, as fractions of the framebuffer, and the camera it shows:
+ * 1 tower, 2 block, 3 top, 4 front, 5 helicopter, or CAMERA_ACTIVE */
+struct View {
+  float x, y, w, h;
+  int camera;
+};
+
+#define MAX_VIEWS 4
+
+/* View-projection matrices of the active views, one aligned slot each,
+ * with the camera and version each slot was last filled from so that the
+ * buffer is only written when a camera changed */
+GLuint viewUBO;
+GLint viewUBOStride;
+std::vector<unsigned char> view_data;
+const Camera* view_slot_cameras[MAX_VIEWS];
+unsigned int view_slot_versions[MAX_VIEWS];
+
+/* Model matrices of the frame's objects, kept between frames to reuse
+ * their storage */
+TransformRing transform_ring;
+std::vector<glm::mat4> frame_models;
+/* This frame's chunks as a flat list, for splitting their work into jobs
+ * and drawing them in the same order their slots were filled */
+std::vector<TileChunk*> frame_chunks;
+/* This frame's draws, sorted before they are submitted */
+RenderQueue render_queue;
+bool state_cache = true;  // false sends redundant GL state calls anyway, to compare
+
+/* Where camera doV stands and looks: 1 tower, 2 block, 3 top, 4 front,
+ * 5 helicopter */
+ CameraLook cameraLook (int doV)
+ {
+  CameraLook look;
+  look.up = glm::vec3(0, 1, 0);
+  switch(doV)
+  {
+    case 1: // tower view circles the board
+    look.eye = glm::vec3(5*cos(camera_rotation_angle*M_PI/180.0f), 3, 5*sin(camera_rotation_angle*M_PI/180.0f));
+    look.target = glm::vec3(0, 0, 0);
+    break;
+    case 2: // follow cam
+    look.eye = rect_pos + glm::vec3(0.0f,0.0f,0.5f);
+    look.target = rect_pos + glm::vec3(0.0f,0.0f,1.0f);
+    break;
+    case 3:
+    look.eye = glm::vec3(0.0f,7.0f,0.0f);
+    look.target = glm::vec3(0.0f,0.0f,0.0f);
+    look.up = glm::vec3(0,0,1);
+    break;
+    case 4:
+    look.eye = rect_pos - glm::vec3(0.0f,0.0f,2.0f);
+    look.target = rect_pos;
+    break;
+    default:
+    look.eye = cameraPos4;
+    look.target = cameraTarget4 + cameraPos4;
+    look.up = cameraUp4;
+    break;
+  }
+  return look;
+ }
+
+/* Camera doV with its cached matrices brought up to date; CAMERA_ACTIVE
+ * is the space-bar camera, part way through a blend if one is running */
+ Camera& viewCamera (int doV)
+ {
+  if(doV!=CAMERA_ACTIVE)
+  {
+    Camera& camera = cameras[doV-1];
+    setCameraLook(camera, cameraLook(doV));
+    render_stats.camera_updates += updateCamera(camera);
+    return camera;
+  }
+  CameraLook look = cameraLook(view_var+1);
+  if(camera_blend<1)
+    look = blendCameraLook(blend_from, look, camera_blend);
+  setCameraLook(active_camera, look);
+  render_stats.camera_updates += updateCamera(active_camera);
+  return active_camera;
+ }
+
+/* Distance in the ground plane from p to a chunk's bounds */
+ float chunkDistance (const ChunkBounds& chunk, glm::vec3 p)
+ {
+  float dx = max(max(chunk.lo.x - p.x, p.x - chunk.hi.x), 0.0f);
+  float dz = max(max(chunk.lo.z - p.z, p.z - chunk.hi.z), 0.0f);
+  return sqrt(dx*dx + dz*dz);
+ }
+
+/* Page chunks in and out around the focus points (the block and the
+ * cameras). Chunks past the radius, plus half a chunk so that walking
+ * along a boundary does not load and drop the same chunk over and over,
+ * are evicted; missing chunks in range are queued nearest first while the
+ * budget allows; and if the budget is still exceeded the farthest chunks
+ * go. Builds run on loader threads and uploads are spread over frames,
+ * so crossing into new chunks costs the frame nothing. */
+ void streamChunks (const glm::vec3* focus, int nfocus)
+ {
+  float keep = stream_radius + CHUNK_SIZE*0.25f;
+  int loading = 0;
+  // Scratch lists live in the frame arena, so streaming costs no heap
+  ArenaVector<std::pair<float,int> > resident(frame_arena);
+  ArenaVector<int> evict(frame_arena);
+  resident.reserve(tile_chunks.size());
+  evict.reserve(tile_chunks.size());
+  for(auto it=tile_chunks.begin();it!=tile_chunks.end();++it)
+  {
+    float d = 1e30f;
+    for(int f=0;f<nfocus;f++)
+      d = min(d, chunkDistance(*it->second, focus[f]));
+    if(d > keep)
+      evict.push_back(it->first);
+    else if(it->second->state==CHUNK_LOADING)
+      loading++;
+    else
+      resident.push_back(std::make_pair(d, it->first));
+  }
+  for(unsigned int n=0;n<evict.size();n++)
+  {
+    evictChunk(evict[n]);
+    stream_evictions++;
+  }
+
+    // Chunks in range of any focus that are not loaded yet; the focus
+    // areas overlap, so a chunk may be found twice
+  ArenaVector<std::pair<float,int> > wanted(frame_arena);
+  ChunkBounds probe;
+  for(int f=0;f<nfocus;f++)
+  {
+    // Cells around the focus; cellPosition is cell/2 about the level centre
+    float ci = (focus[f].x - floor_pos.x)*2 + (current_level.width-1)/2.0f;
+    float cj = (focus[f].z - floor_pos.z)*2 + (current_level.depth-1)/2.0f;
+    int cx0 = max(0, (int)floor((ci - 2*stream_radius)/CHUNK_SIZE));
+    int cx1 = min(chunks_x-1, (int)floor((ci + 2*stream_radius)/CHUNK_SIZE));
+    int cz0 = max(0, (int)floor((cj - 2*stream_radius)/CHUNK_SIZE));
+    int cz1 = min(chunks_z-1, (int)floor((cj + 2*stream_radius)/CHUNK_SIZE));
+    for(int cz=cz0;cz<=cz1;cz++)
+      for(int cx=cx0;cx<=cx1;cx++)
+      {
+        int key = cz*chunks_x + cx;
+        if(tile_chunks.count(key))
+          continue;
+        setChunkBounds(probe, cx, cz);
+        float d = 1e30f;
+        for(int g=0;g<nfocus;g++)
+          d = min(d, chunkDistance(probe, focus[g]));
+        if(d <= stream_radius)
+          wanted.push_back(std::make_pair(d, key));
+      }
+  }
+  sort(wanted.begin(), wanted.end());
+  wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+
+    // Chunks still loading count at the average size of the loaded ones
+  size_t estimate = resident.empty() ? CHUNK_SIZE*CHUNK_SIZE*200 : stream_bytes/resident.size();
+  for(unsigned int n=0;n<wanted.size();n++)
+  {
+    if(stream_bytes + (loading+1)*estimate > stream_budget)
+      break;
+    loadChunk(wanted[n].second);
+    loading++;
+  }
+
+    // Over budget: the farthest loaded chunks make room for nearer ones
+  sort(resident.begin(), resident.end());
+  while(stream_bytes > stream_budget && resident.size() > 1)
+  {
+    evictChunk(resident.back().second);
+    resident.pop_back();
+    stream_evictions++;
+  }
+ }
+
+/* The views to draw this frame: the space-bar camera alone, or in split
+ * screen the tower, top and front cameras plus the space-bar camera */
+ int activeViews (View* views)
+ {
+  View single = { 0, 0, 1, 1, CAMERA_ACTIVE };
+  View split[MAX_VIEWS] = {
+    { 0, 0.5, 0.5, 0.5, 1 },
+    { 0.5, 0.5, 0.5, 0.5, 3 },
+    { 0, 0, 0.5, 0.5, 4 },
+    { 0.5, 0, 0.5, 0.5, CAMERA_ACTIVE }
+  };
+  if(!split_screen)
+  {
+    views[0] = single;
+    return 1;
+  }
+  for(int v=0;v<MAX_VIEWS;v++)
+    views[v] = split[v];
+  return MAX_VIEWS;
+ }
+
+/* Point the viewport and the ViewBlock binding at view v */
+ void selectView (const View& view, int v)
+ {
+  setViewport((int)(view.x*fb_width), (int)(view.y*fb_height), (int)(view.w*fb_width), (int)(view.h*fb_height));
+  bindUniformRange(0, viewUBO, v*viewUBOStride, sizeof(glm::mat4));
+ }
+
+/* Distance from a camera to p as a fraction of its far plane, to draw
+ * near objects first */
+ float drawDepth (const Camera& camera, glm::vec3 p)
+ {
+  return glm::length(p - camera.look.eye)/camera.zfar;
+ }
+
+/* Bit v is set if the chunk is inside view v's frustum */
+ unsigned int chunkVisibility (const TileChunk& chunk, const Frustum* frustums, int nviews)
+ {
+  unsigned int mask = 0;
+  for(int v=0;v<nviews;v++)
+    if(boxVisible(frustums[v], chunk.lo, chunk.hi))
+      mask |= 1u << v;
+  return mask;
+ }
+
+/* Count a chunk and its tiles as drawn or culled in each view */
+ void countChunkVisibility (const TileChunk& chunk, int nviews)
+ {
+  int tiles = chunk.floor.size() + chunk.breakable.size();
+  for(int v=0;v<nviews;v++)
+  {
+    if(chunk.visible & (1u << v))
+    {
+      render_stats.chunks_drawn++;
+      render_stats.tiles_drawn += tiles;
     }
-    int i,j;
-    glm::vec3 tile;
-    for(i=0;i<3;i++)
+    else
     {
-      j=0;
-      tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-      Matrices.model = glm::translate(floor_pos+tile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(tiles[i][j]);
+      render_stats.chunks_culled++;
+      render_stats.tiles_culled += tiles;
     }
-    for(i=0;i<6;i++)
+  }
+ }
+
+/* Render the scene with openGL */
+/* Each object is visited once, its model matrix set once, and then it is
+ * drawn into every view; only the ViewBlock binding changes between views */
+ void draw (const View* views, int nviews)
+ {
+  int v;
+  Camera* view_cameras[MAX_VIEWS];
+  Frustum frustums[MAX_VIEWS];
+  bool changed = false;
+
+    // Bring each view's camera up to date; only slots whose camera moved
+    // are rewritten, and the buffer is uploaded once if any was
+  view_data.resize(MAX_VIEWS*viewUBOStride);
+  for(v=0;v<nviews;v++)
+  {
+    view_cameras[v] = &viewCamera(views[v].camera);
+    frustums[v] = view_cameras[v]->frustum;
+    if(view_slot_cameras[v]!=view_cameras[v] || view_slot_versions[v]!=view_cameras[v]->version)
     {
-      j=1;
-      tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-      Matrices.model = glm::translate(floor_pos+tile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(tiles[i][j]);
+      memcpy(&view_data[v*viewUBOStride], &view_cameras[v]->VP[0][0], sizeof(glm::mat4));
+      view_slot_cameras[v] = view_cameras[v];
+      view_slot_versions[v] = view_cameras[v]->version;
+      changed = true;
     }
-    for(i=0;i<8;i++)
+  }
+  if(changed)
+  {
+    glBindBuffer(GL_UNIFORM_BUFFER, viewUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, nviews*viewUBOStride, &view_data[0]);
+    render_stats.uniform_uploads++;
+  }
+
+  if(level_ready)
+  {
+    glm::vec3 focus[1+MAX_VIEWS];
+    focus[0] = rect_pos;
+    for(v=0;v<nviews;v++)
+      focus[1+v] = view_cameras[v]->look.eye;
+    streamChunks(focus, 1+nviews);
+  }
+  rebuildDirtyChunks();
+  unsigned int k,n;
+  int slot;
+
+    // Which views see each chunk; empty chunks and chunks not loaded yet
+    // are skipped, and chunks outside a view's frustum are skipped for it.
+    // The chunks are tested on the job workers, then counted here.
+  frame_chunks.clear();
+  for(auto c=tile_chunks.begin();c!=tile_chunks.end();++c)
+    frame_chunks.push_back(c->second);
+  parallelFor("cull.chunks", frame_chunks.size(), 64, [&] (int first, int last) {
+    for(int i=first;i<last;i++)
     {
-      j=2;
-      tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-      Matrices.model = glm::translate(floor_pos+tile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(tiles[i][j]);
+      TileChunk& chunk = *frame_chunks[i];
+      if(!chunk.mesh || chunk.mesh->NumVertices==0)
+        chunk.visible = 0;
+      else
+        chunk.visible = chunkVisibility(chunk, frustums, nviews);
     }
-    for(i=1;i<10;i++)
+  });
+  for(k=0;k<frame_chunks.size();k++)
+    if(frame_chunks[k]->visible)
+      countChunkVisibility(*frame_chunks[k], nviews);
+
+    // Every model matrix of the frame goes into the transform ring in one
+    // upload: slot 0 is the block, slot 1 the merged chunks (already in
+    // world space), then one slot per visible tile when drawing per tile
+  frame_models.clear();
+  frame_models.push_back(block_model);
+  frame_models.push_back(glm::mat4(1.0f));
+  if(tile_mode==TILES_PER_TILE)
+  {
+    // Each visible chunk gets its run of slots, and the runs are filled
+    // from the chunks' transform stores on the job workers
+    ArenaVector<int> firsts(frame_chunks.size(), 0, frame_arena);
+    int total = frame_models.size();
+    for(k=0;k<frame_chunks.size();k++)
     {
-      j=3;
-      tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-      Matrices.model = glm::translate(floor_pos+tile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(tiles[i][j]);
+      firsts[k] = total;
+      if(frame_chunks[k]->visible)
+        total += frame_chunks[k]->entities.size();
     }
-    for(i=5;i<10;i++)
+    frame_models.resize(total);
+    parallelFor("transforms.tiles", frame_chunks.size(), 4, [&] (int first, int last) {
+      for(int i=first;i<last;i++)
+        if(frame_chunks[i]->visible)
+          buildModelMatrices(frame_chunks[i]->entities, &frame_models[firsts[i]]);
+    });
+  }
+  uploadTransforms(transform_ring, frame_models);
+
+    // Collect the frame's draws, one per object and view that sees it, and
+    // submit them sorted so that state is only set when it changes
+  {
+  ProfileScope scope("render.queue");
+  clearRenderQueue(render_queue);
+  for(v=0;v<nviews && level_ready;v++)
+    queueDraw(render_queue, v, programID, rectangle, 0, drawDepth(*view_cameras[v], rect_pos));
+  for(k=0;k<frame_chunks.size();k++)
+  {
+    const TileChunk& chunk = *frame_chunks[k];
+    if(!chunk.visible)
+      continue;
+    glm::vec3 centre = (chunk.lo + chunk.hi)*0.5f;
+    for(v=0;v<nviews;v++)
     {
-      j=4;
-      if(i!=7)
+      if(!(chunk.visible & (1u << v)))
+        continue;
+      // Merged: the chunk is one static mesh, already in world space.
+      // Instanced: one call per kind of tile.
+      if(tile_mode==TILES_MERGED)
+        queueDraw(render_queue, v, programID, chunk.mesh, 1, drawDepth(*view_cameras[v], centre));
+      else if(tile_mode==TILES_INSTANCED)
       {
-        tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-        Matrices.model = glm::translate(floor_pos+tile);
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-        draw3DObject(tiles[i][j]);
+        queueDrawInstanced(render_queue, v, instancedProgramID, chunk.breakInstances, drawDepth(*view_cameras[v], centre));
+        queueDrawInstanced(render_queue, v, instancedProgramID, chunk.floorInstances, drawDepth(*view_cameras[v], centre));
       }
     }
-    for(i=6;i<9;i++)
-    {
-      j=5;
-      tile = glm::vec3((i-4.5)/2,0,(j-4.5)/2);
-      Matrices.model = glm::translate(floor_pos+tile);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-      draw3DObject(tiles[i][j]);
-    }
-    if(rect_pos.z<-2.25 || rect_pos.x<-2.25 || rect_pos.z>1.25 || rect_pos.x>2.25)
-      falling=1;
-    if(rect_pos.x>-1.25 && rect_pos.z<-1.75)
-      falling=1;
-    if(rect_pos.z<-1.25 && rect_pos.x>0.25)
-      falling=1;
-     if(rect_pos.z<-0.75 && rect_pos.x>1.25)
-      falling=1;
-     if(rect_pos.z>-1.25 && (rect_pos.x>2.25 || rect_pos.x<-1.75))
-      falling=1;
-     if(rect_pos.z>-0.75 && (rect_pos.x>2.25 || rect_pos.x<0.25))
-      falling=1;
-     if(rect_pos.z>-0.25 && (rect_pos.x>1.75 || rect_pos.x<0.75))
-      falling=1;
-    if (dir=="oy" && rect_pos.x==1.25 && rect_pos.z==-0.25)
-      falling=1;
-    if(falling==1)
+  }
+  if(tile_mode==TILES_PER_TILE)
+  {
+    // Tiles take their slots in the order they were written above
+    slot = 2;
+    for(k=0;k<frame_chunks.size();k++)
     {
-      rect_pos.y-=0.5;
-      rectangle_rotation=90;
-      flag=0;
+      if(!frame_chunks[k]->visible)
+        continue;
+      const TileChunk& chunk = *frame_chunks[k];
+      const EntityStore& tiles = chunk.entities;
+      for(n=0;n<chunk.breakable.size()+chunk.floor.size();n++,slot++)
+      {
+        glm::vec3 pos(tiles.px[n], tiles.py[n], tiles.pz[n]);
+        for(v=0;v<nviews;v++)
+          if(chunk.visible & (1u << v))
+            queueDraw(render_queue, v, programID, n<chunk.breakable.size() ? breakTile : floorTile, slot, drawDepth(*view_cameras[v], pos));
+      }
     }
+  }
+  if(debris.size()>0)
+  {
+    // Every fragment in one instanced draw per view
+    debrisInstances(debris, debris_instances);
+    updateInstancedObject(debrisBatch, debris_instances);
+    for(v=0;v<nviews;v++)
+      queueDrawInstanced(render_queue, v, instancedProgramID, debrisBatch, 0);
+  }
+  }
 
+  {
+  ProfileScope scope("render.submit", true);
+  submitRenderQueue(render_queue, transform_ring, [views] (int view) { selectView(views[view], view); });
+  }
+  fenceTransforms(transform_ring);
   }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -839,7 +1513,7 @@ Btile=glm::vec3((3.5-k)/2,0,(2.5-l)/2);
 
    glfwMakeContextCurrent(window);
     //    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-   glfwSwapInterval( 1 );
+   glfwSwapInterval( swap_interval );
    glfwSetFramebufferSizeCallback(window, reshapeWindow);
    glfwSetWindowSizeCallback(window, reshapeWindow);
    glfwSetWindowCloseCallback(window, quit);
@@ -852,22 +1526,44 @@ Btile=glm::vec3((3.5-k)/2,0,(2.5-l)/2);
 
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
-  void initGL (GLFWwindow* window, int width, int height)
+  void initGL (int fbwidth, int fbheight)
   {
     /* Objects should be created before any other gl function and shaders */
+    resetGLState();
     // Create the models
     createRectangle ();
     //createCam();
     createBreakableTiles();
     createFloor();
+    createDebris();
 
     // Create and compile our GLSL program from the shaders
+    {
+    ProfileScope scope("init.shaders");
     programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-    // Get a handle for our "MVP" uniform
-    Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+    // Tiles drawn with per-instance offsets only need the view-projection
+    instancedProgramID = LoadShaders( "Instanced_GL.vert", "Sample_GL.frag" );
+    }
+    if (!programID || !instancedProgramID)
+      exit(EXIT_FAILURE);
 
+    // Both programs read the view-projection from the ViewBlock at binding 0,
+    // one slot per view, padded to the driver's offset alignment
+    GLint align;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    viewUBOStride = ((sizeof(glm::mat4) + align - 1) / align) * align;
+    glGenBuffers(1, &viewUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, viewUBO);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_VIEWS*viewUBOStride, NULL, GL_DYNAMIC_DRAW);
+    glUniformBlockBinding(programID, glGetUniformBlockIndex(programID, "ViewBlock"), 0);
+    glUniformBlockBinding(instancedProgramID, glGetUniformBlockIndex(instancedProgramID, "ViewBlock"), 0);
 
-    reshapeWindow (window, width, height);
+    // Per-object model matrices come from a triple-buffered ring
+    createTransformRing(transform_ring, 1024);
+    attachTransforms(transform_ring, programID);
+
+
+    resizeFramebuffer (fbwidth, fbheight);
 
     // Background color of the scene
     glClearColor (0.3f, 0.3f, 0.3f, 0.0f); // R, G, B, A
@@ -882,6 +1578,187 @@ Btile=glm::vec3((3.5-k)/2,0,(2.5-l)/2);
     // cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
   }
 
+/* Nearest-rank percentile of a sorted sample */
+  double percentile (const vector<double>& sorted, double p)
+  {
+    if (sorted.empty())
+      return 0;
+    size_t rank = (size_t) ceil(p/100.0*sorted.size());
+    return sorted[rank ? rank-1 : 0];
+  }
+
+/* Render 'frames' frames into the current framebuffer, giving each of the
+ * five cameras an equal run of frames along a scripted path, and print
+ * frame time percentiles with per-frame draw calls and uniform uploads */
+  void runBenchmark (int frames)
+  {
+    static const char* camera_names[5] = { "tower", "block", "top", "front", "helicopter" };
+    vector<double> times[5];
+    long long draw_calls[5] = {0}, uniform_uploads[5] = {0};
+    long long tiles_drawn[5] = {0}, tiles_culled[5] = {0};
+    long long fence_waits = 0, camera_updates = 0;
+    long long state_calls = 0, state_redundant = 0;
+    vector<double> all;
+    all.reserve(frames);
+    for (int c=0; c<5; c++)
+      times[c].reserve(frames/5 + 1);
+
+    printf("renderer: %s\n", glGetString(GL_RENDERER));
+    printf("%d frames at %dx%d, %s tiles\n", frames, fb_width, fb_height, tile_mode_names[tile_mode]);
+    for (int f=0; f<frames; f++)
+    {
+      int camera = f*5/frames;
+      float t = (float)f/frames;
+
+      // Tower camera circles the board, the helicopter orbits it looking at the centre
+      camera_rotation_angle = 225 + 720*t;
+      cameraPos4 = glm::vec3(4*cos(4*M_PI*t), 3, 4*sin(4*M_PI*t));
+      cameraTarget4 = glm::normalize(-cameraPos4);
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      arenaReset(frame_arena);
+      allocFrame();
+      resetRenderStats();
+      profilerBeginFrame(f);
+      {
+        ProfileScope scope("frame");
+        View view = { 0, 0, 1, 1, camera+1 };
+        loaderProcessUploads(0.002);
+        advanceSimulation(1/60.0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw(&view, 1);
+        glFinish();
+      }
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      times[camera].push_back(ms);
+      all.push_back(ms);
+      draw_calls[camera] += render_stats.draw_calls;
+      uniform_uploads[camera] += render_stats.uniform_uploads;
+      tiles_drawn[camera] += render_stats.tiles_drawn;
+      tiles_culled[camera] += render_stats.tiles_culled;
+      fence_waits += render_stats.fence_waits;
+      camera_updates += render_stats.camera_updates;
+      state_calls += render_stats.state_calls;
+      state_redundant += render_stats.state_redundant;
+    }
+    allocFrame();  // close the last frame before reporting allocates
+
+    printf("%-12s %7s %9s %9s %9s %9s %9s %9s %9s\n", "camera", "frames", "p50 ms", "p95 ms", "p99 ms", "draws", "uniforms", "tiles", "culled");
+    long long total_draws = 0, total_uniforms = 0, total_drawn = 0, total_culled = 0;
+    for (int c=0; c<5; c++)
+    {
+      int n = times[c].size();
+      sort(times[c].begin(), times[c].end());
+      printf("%-12s %7d %9.3f %9.3f %9.3f %9.1f %9.1f %9.1f %9.1f\n", camera_names[c], n,
+        percentile(times[c], 50), percentile(times[c], 95), percentile(times[c], 99),
+        n ? (double)draw_calls[c]/n : 0.0, n ? (double)uniform_uploads[c]/n : 0.0,
+        n ? (double)tiles_drawn[c]/n : 0.0, n ? (double)tiles_culled[c]/n : 0.0);
+      total_draws += draw_calls[c];
+      total_uniforms += uniform_uploads[c];
+      total_drawn += tiles_drawn[c];
+      total_culled += tiles_culled[c];
+    }
+    sort(all.begin(), all.end());
+    printf("%-12s %7d %9.3f %9.3f %9.3f %9.1f %9.1f %9.1f %9.1f\n", "all", frames,
+      percentile(all, 50), percentile(all, 95), percentile(all, 99),
+      frames ? (double)total_draws/frames : 0.0, frames ? (double)total_uniforms/frames : 0.0,
+      frames ? (double)total_drawn/frames : 0.0, frames ? (double)total_culled/frames : 0.0);
+    printf("transform ring: %lld of %d frames waited for the GPU\n", fence_waits, frames);
+    printf("cameras: rebuilt %lld times in %d frames\n", camera_updates, frames);
+    printf("GL state: %.1f calls per frame, %.1f redundant ones %s\n", frames ? (double)state_calls/frames : 0.0,
+      frames ? (double)state_redundant/frames : 0.0, state_cache ? "dropped" : "sent anyway");
+    printf("jobs on %d workers:\n", jobWorkers());
+    printJobStats(stdout);
+    printf("chunks: %d resident in %.1f MB, %d loads, %d evictions\n", (int)tile_chunks.size(), stream_bytes/1048576.0, stream_loads, stream_evictions);
+    if (allocTrackingEnabled())
+      printAllocStats(stdout);
+  }
+
+/* Largest difference between two runs of matrices */
+  float maxMatrixError (const vector<glm::mat4>& a, const vector<glm::mat4>& b)
+  {
+    float worst = 0;
+    for (size_t i=0; i<a.size(); i++)
+      for (int c=0; c<4; c++)
+        for (int r=0; r<4; r++)
+          worst = max(worst, (float)fabs(a[i][c][r] - b[i][c][r]));
+    return worst;
+  }
+
+/* Time building n model matrices with per-object glm calls against the
+ * batch kernels over the structure-of-arrays store */
+  void runTransformBenchmark (int n)
+  {
+    EntityStore store;
+    vector<glm::vec3> positions(n), axes(n), scales(n);
+    vector<float> angles(n);
+    srand(1);
+    for (int i=0; i<n; i++)
+    {
+      positions[i] = glm::vec3(rand()%1000, rand()%10, rand()%1000) * 0.5f;
+      axes[i] = glm::normalize(glm::vec3(rand()%100+1, rand()%100, rand()%100));
+      angles[i] = (rand()%628)/100.0f;
+      scales[i] = glm::vec3(1 + rand()%3, 1, 1 + rand()%3);
+      float h = sin(angles[i]/2);
+      addEntity(store, positions[i], glm::vec4(axes[i]*h, cos(angles[i]/2)), scales[i]);
+    }
+    vector<glm::mat4> reference(n), models(n);
+
+    // Each variant runs a few times and keeps its fastest pass
+    const int runs = 5;
+    double best;
+    printf("%d entities, best of %d runs\n", n, runs);
+    printf("%-28s %10s %10s %10s\n", "path", "ms", "ns/object", "max error");
+
+    best = 1e30;
+    for (int r=0; r<runs; r++)
+    {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int i=0; i<n; i++)
+        reference[i] = glm::translate(positions[i]) * glm::rotate(angles[i], axes[i]) * glm::scale(scales[i]);
+      best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    printf("%-28s %10.3f %10.2f %10s\n", "model: glm per object", best, best*1e6/n, "-");
+
+    for (int k=KERNEL_SCALAR; k<=(int)bestTransformKernel(); k++)
+    {
+      best = 1e30;
+      for (int r=0; r<runs; r++)
+      {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        buildModelMatrices(store, &models[0], (TransformKernel)k);
+        best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+      }
+      char name[64];
+      snprintf(name, sizeof(name), "model: %s batch", transformKernelName((TransformKernel)k));
+      printf("%-28s %10.3f %10.2f %10.2g\n", name, best, best*1e6/n, maxMatrixError(models, reference));
+    }
+  }
+
+/* Collapse 'tiles' tiles at once and time the debris updates until the
+ * fragments have fallen out of sight */
+  void runDebrisBenchmark (int tiles)
+  {
+    Debris bench;
+    for (int i=0; i<tiles; i++)
+      spawnDebris(bench, glm::vec3(i%256, 0, i/256), 1, glm::vec3(0.95, 0.8, 0.1), i);
+    int spawned = bench.size();
+    double total = 0, peak = 0;
+    int ticks = 0;
+    while (bench.size() > 0)
+    {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      updateDebris(bench, SIM_DT, GRAVITY);
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      total += ms;
+      peak = max(peak, ms);
+      ticks++;
+    }
+    printf("%d tiles, %d fragments, %d ticks until all fell, %d workers\n", tiles, spawned, ticks, jobWorkers());
+    printf("update: %.3f ms avg, %.3f ms peak per tick (%.2f ns per fragment at spawn)\n", total/ticks, peak, ticks ? total/ticks*1e6/spawned : 0.0);
+  }
+
   int main (int argc, char** argv)
   {
     int width = 700;
@@ -891,45 +1768,292 @@ Btile=glm::vec3((3.5-k)/2,0,(2.5-l)/2);
     floor_pos = glm::vec3(0, 0, 0);
     do_rot = 0;
     floor_rel = 1;
-    if (level==1)
+    const char* level_path = "levels/level1.txt";
+    bool solve_only = false;
+    vector<const char*> replay_files;
+    int threads = 0;
+    int bench_frames = 0;
+    int bench_transforms = 0;
+    int bench_debris = 0;
+    const char* play_path = NULL;
+    bool headless = false;
+    int generate_count = 0;
+    const char* generate_dir = NULL;
+    GeneratorParams gen_params = { 16, 16, 12, 1, 50 };
+    for (int a=1; a<argc; a++)
+    {
+      if (!strcmp(argv[a], "--level") && a+1<argc)
+        level_path = argv[++a];
+      else if (!strcmp(argv[a], "--solve"))
+        solve_only = true;
+      else if (!strcmp(argv[a], "--replay") && a+1<argc)
+        replay_files.push_back(argv[++a]);
+      else if (!strcmp(argv[a], "--threads") && a+1<argc)
+        threads = atoi(argv[++a]);
+      else if (!strcmp(argv[a], "--bench") && a+1<argc)
+        bench_frames = atoi(argv[++a]);
+      else if (!strcmp(argv[a], "--bench-transforms") && a+1<argc)
+        bench_transforms = atoi(argv[++a]);
+      else if (!strcmp(argv[a], "--bench-debris") && a+1<argc)
+        bench_debris = atoi(argv[++a]);
+      else if (!strcmp(argv[a], "--track-allocs"))
+        allocTrackingEnable(true);
+      else if (!strcmp(argv[a], "--per-tile"))
+        tile_mode = TILES_PER_TILE;
+      else if (!strcmp(argv[a], "--instanced"))
+        tile_mode = TILES_INSTANCED;
+      else if (!strcmp(argv[a], "--stream-radius") && a+1<argc)
+        stream_radius = atof(argv[++a]);
+      else if (!strcmp(argv[a], "--stream-budget") && a+1<argc)
+        stream_budget = (size_t)atoi(argv[++a]) << 20;
+      else if (!strcmp(argv[a], "--split"))
+        split_screen = true;
+      else if (!strcmp(argv[a], "--no-vsync"))
+        swap_interval = 0;
+      else if (!strcmp(argv[a], "--record") && a+1<argc)
+        record_path = argv[++a];
+      else if (!strcmp(argv[a], "--play-input") && a+1<argc)
+        play_path = argv[++a];
+      else if (!strcmp(argv[a], "--headless"))
+        headless = true;
+      else if (!strcmp(argv[a], "--no-shader-cache"))
+        shader_cache_dir = NULL;
+      else if (!strcmp(argv[a], "--no-state-cache"))
+      {
+        state_cache = false;
+        setGLStateCache(false);
+      }
+      else if (!strcmp(argv[a], "--trace") && a+1<argc)
+      {
+        trace_path = argv[++a];
+        profilerEnable(true);
+      }
+      else if (!strcmp(argv[a], "--generate") && a+2<argc)
+      {
+        generate_count = atoi(argv[++a]);
+        generate_dir = argv[++a];
+      }
+      else if (!strcmp(argv[a], "--size") && a+2<argc)
+      {
+        gen_params.width = atoi(argv[++a]);
+        gen_params.depth = atoi(argv[++a]);
+      }
+      else if (!strcmp(argv[a], "--difficulty") && a+1<argc)
+        gen_params.min_moves = atoi(argv[++a]);
+      else if (!strcmp(argv[a], "--seed") && a+1<argc)
+        gen_params.seed = strtoul(argv[++a], NULL, 10);
+      else if (!strcmp(argv[a], "--pack-level") && a+2<argc)
+      {
+        // Convert a level to the binary form and exit
+        if (!loadLevel(argv[a+1], current_level) || !saveLevelBinary(argv[a+2], current_level))
+          exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+      }
+      else
+      {
+        fprintf(stderr, "usage: %s [--level file] [--solve] [--replay scripts]... [--threads n] [--bench frames] [--bench-transforms n] [--bench-debris tiles] [--per-tile|--instanced] [--stream-radius units] [--stream-budget MB] [--track-allocs] [--split] [--no-vsync] [--no-shader-cache] [--no-state-cache] [--record log] [--play-input log [--headless]] [--trace out.json|out.csv] [--pack-level in out] [--generate count dir [--size w d] [--difficulty moves] [--seed n]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (bench_transforms > 0)
+    {
+      runTransformBenchmark(bench_transforms);
+      exit(EXIT_SUCCESS);
+    }
+    if (bench_debris > 0)
+    {
+      jobsStart(threads);
+      runDebrisBenchmark(bench_debris);
+      jobsStop();
+      exit(EXIT_SUCCESS);
+    }
+    if (generate_count > 0)
+    {
+      // Write solvable levels to dir/level_NNNN.txt and list their optimal move counts
+      // Smaller grids have no standing cell besides the start for the goal
+      if (gen_params.width < 3 || gen_params.depth < 3)
+      {
+        fprintf(stderr, "--size must be at least 3 3\n");
+        exit(EXIT_FAILURE);
+      }
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      vector<GeneratedLevel> levels = generateLevels(gen_params, generate_count, threads);
+      fprintf(stderr, "generated %d levels in %.3f s\n", generate_count, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+      printf("file,min_moves,attempts,met_target\n");
+      char path[1024];
+      bool ok = true;
+      for (int n=0; n<generate_count; n++)
+      {
+        snprintf(path, sizeof(path), "%s/level_%04d.txt", generate_dir, n);
+        // A level without a verified solution is never written
+        if (levels[n].min_moves < 0)
+        {
+          fprintf(stderr, "%s: no solvable level generated, not written\n", path);
+          ok = false;
+          continue;
+        }
+        ok = saveLevelText(path, levels[n].level) && ok;
+        printf("%s,%d,%d,%s\n", path, levels[n].min_moves, levels[n].attempts, levels[n].met_target ? "yes" : "no");
+      }
+      exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if ((solve_only || !replay_files.empty()) && !loadLevel(level_path, current_level))
+      exit(EXIT_FAILURE);
+    if (solve_only)
+    {
+      // Print the optimal solution without opening a window
+      // The solution line is itself a move script for --replay
+      SolveResult result = solveLevel(current_level, threads);
+      if (result.solved)
+      {
+        printf("# %s: solvable in %d moves (%lld states explored)\n", level_path, (int)result.moves.size(), result.states_explored);
+        for (unsigned int n=0; n<result.moves.size(); n++)
+          printf("%s%s", n ? " " : "", moveName(result.moves[n]));
+        printf("\n");
+      }
+      else
+        printf("# %s: unsolvable (%lld states explored)\n", level_path, result.states_explored);
+      exit(result.solved ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (!replay_files.empty())
+    {
+      // Check recorded move scripts against the level without opening a window
+      vector<MoveScript> scripts;
+      for (unsigned int n=0; n<replay_files.size(); n++)
+        if (!readMoveScripts(replay_files[n], scripts))
+          exit(EXIT_FAILURE);
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      vector<ReplayResult> results = replayScripts(current_level, scripts, threads);
+      fprintf(stderr, "replayed %d scripts in %.3f s\n", (int)scripts.size(), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+      writeReplayResults(stdout, scripts, results);
+      exit(EXIT_SUCCESS);
+    }
+    if (play_path)
     {
-      rect_pos.x=-1.75;
-      rect_pos.y=0.25;
-      rect_pos.z=-1.75;
-      dir="oy";
-      flag=0;
-      rectangle_rotation=90;
-      level=0;
+      if (!readInputLog(play_path, replay_events, replay_level_hash))
+        exit(EXIT_FAILURE);
+      replaying = true;
     }
+    if (play_path && headless)
+    {
+      // Run the recorded session without rendering, as fast as the CPU allows
+      if (!loadLevel(level_path, current_level))
+        exit(EXIT_FAILURE);
+      best_moves = solveBest(current_level, threads);
+      placeBlock();
+      static const char* orient_names[] = { "standing", "lying x", "lying z" };
+      static const char* status_names[] = { "playing", "fell", "won" };
+      // Run on long enough for the last roll or fall to play out
+      unsigned int end_tick = (replay_events.empty() ? 0 : replay_events.back().tick) + (unsigned int)(2/SIM_DT);
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      while (sim_tick < end_tick)
+        runTick();
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      printf("# %s: %d events, %u ticks (%.1f s of play) in %.3f ms\n", play_path, (int)replay_events.size(), sim_tick, sim_tick*SIM_DT, ms);
+      printf("block (%d,%d) %s, %s after %d moves, state %016llx\n", block.x, block.z, orient_names[block.orient], status_names[block_status], moves, sessionHash());
+      exit(EXIT_SUCCESS);
+    }
+    if (bench_frames > 0)
+    {
+      // Render offscreen without a window, report and exit
+      if (!createOffscreenContext())
+        exit(EXIT_FAILURE);
+      initGLEW();
+      if (!createOffscreenFramebuffer(width, height))
+        exit(EXIT_FAILURE);
+      initGL (width, height);
+      jobsStart(threads);
+      loaderStart(threads);
+      streamLevel(level_path);
+      loaderFinish();
+      checkStreaming(level_path);
+      runBenchmark(bench_frames);
+      stopBestSolve();
+      loaderStop();
+      jobsStop();
+      writeTrace();
+      destroyOffscreenContext();
+      exit(EXIT_SUCCESS);
+    }
+
+    // The window opens and renders straight away; the level streams in behind it
     GLFWwindow* window = initGLFW(width, height);
     initGLEW();
-    initGL (window, width, height);
+    int fbwidth, fbheight;
+    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    initGL (fbwidth, fbheight);
+    jobsStart(threads);
+    loaderStart(threads);
+    streamLevel(level_path);
 
     last_update_time = glfwGetTime();
+    double last_stats_time = last_update_time;
+    char title[160];
+    int frame=0;
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)) 
     {
-  // clear the color and depth in the frame buffer
-     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+     arenaReset(frame_arena);
+     allocFrame();
+     profilerBeginFrame(frame++);
+     ProfileScope frame_scope("frame");
+     resetRenderStats();
 
-        // OpenGL Draw commands
+     {
+     // GL uploads of streamed assets get a slice of each frame
+     ProfileScope scope("load.upload");
+     loaderProcessUploads(0.002);
+     checkStreaming(level_path);
+     }
+
+     {
+     ProfileScope scope("update");
      current_time = glfwGetTime();
      if(do_rot)
       camera_rotation_angle += 90*(current_time - last_update_time); // Simulating camera rotation
     if(camera_rotation_angle > 720)
      camera_rotation_angle -= 720;
+   advanceSimulation(current_time - last_update_time);
    last_update_time = current_time;
-   draw(window, 0, 0, 1, 1, 1, view_var+1, 1);
-   //draw(window, 0, 0, 1, 1, 1, 5, 1);
-   //draw(window, 0, 0.5, 0.5, 0.5, 1, 3, 1);
-   //draw(window, 0.5, 0.5, 0.5, 0.5, 1, 4, 1);
+     }
+
+  // clear the color and depth in the frame buffer
+   {
+   ProfileScope scope("render.clear", true);
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   }
+
+        // OpenGL Draw commands
+   View views[MAX_VIEWS];
+   draw(views, activeViews(views));
+
+   // Show the draw calls of the last frame in the title, once a second
+   if(current_time - last_stats_time >= 1.0)
+   {
+    snprintf(title, sizeof(title), "BLOCKARDS - %s tiles, %d draw calls, %d tiles drawn, %d culled, %d chunks in %.0f MB", tile_mode_names[tile_mode], render_stats.draw_calls, render_stats.tiles_drawn, render_stats.tiles_culled, (int)tile_chunks.size(), stream_bytes/1048576.0);
+    glfwSetWindowTitle(window, title);
+    last_stats_time = current_time;
+   }
 
        // Swap Frame Buffer in double buffering
+   {
+   ProfileScope scope("swap", true);
    glfwSwapBuffers(window);
+   }
+   if(frame==1)
+     fprintf(stderr, "first frame %.1f ms after launch\n", chrono::duration<double, milli>(chrono::steady_clock::now() - launch_time).count());
 
         // Poll for Keyboard and mouse events
+   ProfileScope scope("events");
    glfwPollEvents();
  }
+ stopBestSolve();
+ loaderStop();
+ jobsStop();
+ closeInputLog();
+ writeTrace();
+ if(allocTrackingEnabled())
+   printAllocStats(stderr);
  glfwTerminate();
     //    exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,119 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "level.h"
+
+/* Game rules for the 1x1x2 block, independent of GLFW and OpenGL.
+ * Everything here is plain integer arithmetic on grid cells so that
+ * tools and tests can run millions of steps without a window. */
+
+enum Orientation {
+  ORIENT_STANDING,  // covers (x,z) only
+  ORIENT_LYING_X,   // covers (x,z) and (x+1,z)
+  ORIENT_LYING_Z    // covers (x,z) and (x,z+1)
+};
+
+/* Moves are named after the arrow keys that make them: up/down roll
+ * along +z/-z, left/right roll along +x/-x */
+enum Move {
+  MOVE_UP,
+  MOVE_DOWN,
+  MOVE_LEFT,
+  MOVE_RIGHT
+};
+
+/* Key name of a move, as used in move scripts and solver output */
+inline const char* moveName (Move m)
+{
+  static const char* names[] = { "UP", "DOWN", "LEFT", "RIGHT" };
+  return names[m];
+}
+
+/* The move that undoes m - every roll is reversible */
+inline Move inverseMove (Move m)
+{
+  static const Move inverse[] = { MOVE_DOWN, MOVE_UP, MOVE_RIGHT, MOVE_LEFT };
+  return inverse[m];
+}
+
+enum BlockStatus {
+  BLOCK_OK,
+  BLOCK_FELL,  // rolled off the tiles or broke a breakable tile
+  BLOCK_WON    // stood up on the goal hole and dropped through
+};
+
+struct BlockState {
+  int x, z;  // lowest-numbered cell the block covers
+  Orientation orient;
+};
+
+inline bool operator== (const BlockState& a, const BlockState& b)
+{
+  return a.x == b.x && a.z == b.z && a.orient == b.orient;
+}
+
+/* The block standing on the level's start tile */
+inline BlockState startState (const Level& level)
+{
+  BlockState s;
+  s.x = level.start_x;
+  s.z = level.start_z;
+  s.orient = ORIENT_STANDING;
+  return s;
+}
+
+/* Roll the block one move. Pure geometry: support is checked separately. */
+inline BlockState step (BlockState s, Move m)
+{
+  switch (m) {
+    case MOVE_UP:
+    if (s.orient == ORIENT_STANDING) { s.z += 1; s.orient = ORIENT_LYING_Z; }
+    else if (s.orient == ORIENT_LYING_Z) { s.z += 2; s.orient = ORIENT_STANDING; }
+    else s.z += 1;
+    break;
+    case MOVE_DOWN:
+    if (s.orient == ORIENT_STANDING) { s.z -= 2; s.orient = ORIENT_LYING_Z; }
+    else if (s.orient == ORIENT_LYING_Z) { s.z -= 1; s.orient = ORIENT_STANDING; }
+    else s.z -= 1;
+    break;
+    case MOVE_LEFT:
+    if (s.orient == ORIENT_STANDING) { s.x += 1; s.orient = ORIENT_LYING_X; }
+    else if (s.orient == ORIENT_LYING_X) { s.x += 2; s.orient = ORIENT_STANDING; }
+    else s.x += 1;
+    break;
+    case MOVE_RIGHT:
+    if (s.orient == ORIENT_STANDING) { s.x -= 2; s.orient = ORIENT_LYING_X; }
+    else if (s.orient == ORIENT_LYING_X) { s.x -= 1; s.orient = ORIENT_STANDING; }
+    else s.x -= 1;
+    break;
+  }
+  return s;
+}
+
+/* Does the level carry the block in state s? A standing block needs a
+ * solid tile: it breaks a breakable one and drops through the goal.
+ * A lying block spreads its weight and only needs a tile of any kind
+ * (the goal included) under both halves. */
+inline BlockStatus checkBlock (const Level& level, BlockState s)
+{
+  if (s.orient == ORIENT_STANDING) {
+    unsigned char t = levelTile(level, s.x, s.z);
+    if (t == TILE_SOLID)
+      return BLOCK_OK;
+    return t == TILE_GOAL ? BLOCK_WON : BLOCK_FELL;
+  }
+  int x2 = s.orient == ORIENT_LYING_X ? s.x + 1 : s.x;
+  int z2 = s.orient == ORIENT_LYING_Z ? s.z + 1 : s.z;
+  if (levelTile(level, s.x, s.z) == TILE_EMPTY || levelTile(level, x2, z2) == TILE_EMPTY)
+    return BLOCK_FELL;
+  return BLOCK_OK;
+}
+
+/* One full game step: roll, then check what is underneath */
+inline BlockStatus stepBlock (const Level& level, BlockState& s, Move m)
+{
+  s = step(s, m);
+  return checkBlock(level, s);
+}
+
+#endif
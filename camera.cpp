@@ -0,0 +1,56 @@
+#include <math.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "camera.h"
+
+Camera::Camera () : fov(M_PI/2), aspect(1), znear(0.1f), zfar(500.0f),
+                    view_dirty(true), projection_dirty(true), version(0)
+{
+  look.eye = glm::vec3(0, 0, 1);
+  look.target = glm::vec3(0, 0, 0);
+  look.up = glm::vec3(0, 1, 0);
+}
+
+void setCameraLook (Camera& camera, const CameraLook& look)
+{
+  if (look.eye == camera.look.eye && look.target == camera.look.target && look.up == camera.look.up)
+    return;
+  camera.look = look;
+  camera.view_dirty = true;
+}
+
+void setCameraLens (Camera& camera, float fov, float aspect, float znear, float zfar)
+{
+  if (fov == camera.fov && aspect == camera.aspect && znear == camera.znear && zfar == camera.zfar)
+    return;
+  camera.fov = fov;
+  camera.aspect = aspect;
+  camera.znear = znear;
+  camera.zfar = zfar;
+  camera.projection_dirty = true;
+}
+
+bool updateCamera (Camera& camera)
+{
+  if (!camera.view_dirty && !camera.projection_dirty)
+    return false;
+  if (camera.view_dirty)
+    camera.view = glm::lookAt(camera.look.eye, camera.look.target, camera.look.up);
+  if (camera.projection_dirty)
+    camera.projection = glm::perspective(camera.fov, camera.aspect, camera.znear, camera.zfar);
+  camera.VP = camera.projection * camera.view;
+  camera.frustum = frustumFromMatrix(camera.VP);
+  camera.view_dirty = camera.projection_dirty = false;
+  camera.version++;
+  return true;
+}
+
+CameraLook blendCameraLook (const CameraLook& a, const CameraLook& b, float t)
+{
+  // Smoothstep, so the camera leaves and arrives without a jolt
+  float s = t*t*(3 - 2*t);
+  CameraLook look;
+  look.eye = a.eye + (b.eye - a.eye)*s;
+  look.target = a.target + (b.target - a.target)*s;
+  look.up = glm::normalize(a.up + (b.up - a.up)*s);
+  return look;
+}
@@ -0,0 +1,41 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+/* Where a camera stands, what it looks at and which way is up */
+struct CameraLook {
+  glm::vec3 eye, target, up;
+};
+
+/* A camera and everything derived from it: view, projection, their
+ * product and the frustum planes. The setters only mark the camera dirty
+ * when a value actually changes, and updateCamera rebuilds what the
+ * change affects. 'version' goes up on every rebuild, so whoever keeps a
+ * copy of the matrices (a uniform buffer) can tell when to refresh it. */
+struct Camera {
+  CameraLook look;
+  float fov, aspect, znear, zfar;
+
+  glm::mat4 view, projection, VP;
+  Frustum frustum;
+  bool view_dirty, projection_dirty;
+  unsigned int version;
+
+  Camera ();
+};
+
+void setCameraLook (Camera& camera, const CameraLook& look);
+void setCameraLens (Camera& camera, float fov, float aspect, float znear, float zfar);
+
+/* Rebuild the cached matrices and frustum if anything changed since the
+ * last call; returns true if it did */
+bool updateCamera (Camera& camera);
+
+/* The look part way from a to b, for t from 0 to 1, eased in and out */
+CameraLook blendCameraLook (const CameraLook& a, const CameraLook& b, float t);
+
+#endif
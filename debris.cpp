@@ -0,0 +1,89 @@
+#include "jobs.h"
+#include "debris.h"
+
+using namespace std;
+
+/* Fragments per job; fewer than this are updated inline */
+#define DEBRIS_GRAIN 16384
+
+/* xorshift32, enough for scattering fragments */
+static inline float randomUnit (unsigned& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state & 0xffffff) / (float) 0x1000000;
+}
+
+void spawnDebris (Debris& debris, glm::vec3 center, float size, glm::vec3 color, unsigned seed)
+{
+  unsigned state = seed*2654435761u + 1;
+  float piece = size / DEBRIS_SPLIT;
+  for (int i=0; i<DEBRIS_SPLIT; i++) {
+    for (int j=0; j<DEBRIS_SPLIT; j++) {
+      glm::vec3 offset((i + 0.5f)*piece - size/2, 0, (j + 0.5f)*piece - size/2);
+      debris.px.push_back(center.x + offset.x);
+      debris.py.push_back(center.y);
+      debris.pz.push_back(center.z + offset.z);
+      // Pieces burst outwards from the middle and start to drop
+      debris.vx.push_back(offset.x*4 + (randomUnit(state) - 0.5f)*0.5f);
+      debris.vy.push_back(-randomUnit(state)*1.5f);
+      debris.vz.push_back(offset.z*4 + (randomUnit(state) - 0.5f)*0.5f);
+      float shade = 0.7f + 0.3f*randomUnit(state);
+      debris.r.push_back(color.x*shade);
+      debris.g.push_back(color.y*shade);
+      debris.b.push_back(color.z*shade);
+    }
+  }
+}
+
+void updateDebris (Debris& debris, float dt, float gravity)
+{
+  int n = debris.size();
+  if (n == 0)
+    return;
+  float* px = &debris.px[0]; float* py = &debris.py[0]; float* pz = &debris.pz[0];
+  float* vx = &debris.vx[0]; float* vy = &debris.vy[0]; float* vz = &debris.vz[0];
+  parallelFor("debris.update", n, DEBRIS_GRAIN, [=] (int first, int last) {
+    for (int i=first; i<last; i++) {
+      vy[i] -= gravity*dt;
+      px[i] += vx[i]*dt;
+      py[i] += vy[i]*dt;
+      pz[i] += vz[i]*dt;
+    }
+  });
+
+  // Swap-remove the fragments that are gone
+  for (int i=0; i<n; ) {
+    if (debris.py[i] >= DEBRIS_KILL_DEPTH) {
+      i++;
+      continue;
+    }
+    n--;
+    debris.px[i] = debris.px[n]; debris.py[i] = debris.py[n]; debris.pz[i] = debris.pz[n];
+    debris.vx[i] = debris.vx[n]; debris.vy[i] = debris.vy[n]; debris.vz[i] = debris.vz[n];
+    debris.r[i] = debris.r[n]; debris.g[i] = debris.g[n]; debris.b[i] = debris.b[n];
+  }
+  debris.px.resize(n); debris.py.resize(n); debris.pz.resize(n);
+  debris.vx.resize(n); debris.vy.resize(n); debris.vz.resize(n);
+  debris.r.resize(n); debris.g.resize(n); debris.b.resize(n);
+}
+
+void debrisInstances (const Debris& debris, vector<TileInstance>& instances)
+{
+  int n = debris.size();
+  instances.resize(n);
+  parallelFor("debris.instances", n, DEBRIS_GRAIN, [&] (int first, int last) {
+    for (int i=first; i<last; i++) {
+      instances[i].offset = glm::vec3(debris.px[i], debris.py[i], debris.pz[i]);
+      instances[i].color = glm::vec3(debris.r[i], debris.g[i], debris.b[i]);
+    }
+  });
+}
+
+void clearDebris (Debris& debris)
+{
+  debris.px.clear(); debris.py.clear(); debris.pz.clear();
+  debris.vx.clear(); debris.vy.clear(); debris.vz.clear();
+  debris.r.clear(); debris.g.clear(); debris.b.clear();
+}
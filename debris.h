@@ -0,0 +1,33 @@
+#ifndef DEBRIS_H
+#define DEBRIS_H
+
+#include <vector>
+#include "mesh.h"
+
+/* Fragments of collapsed tiles, as structure-of-arrays particles that
+ * fall under gravity until they drop out of sight */
+struct Debris {
+  std::vector<float> px, py, pz;
+  std::vector<float> vx, vy, vz;
+  std::vector<float> r, g, b;
+
+  int size () const { return px.size(); }
+};
+
+#define DEBRIS_SPLIT 8         // a tile breaks into DEBRIS_SPLIT^2 fragments
+#define DEBRIS_KILL_DEPTH -30  // fragments below this height are removed
+
+/* Break a square tile of side 'size' centred at 'center' into fragments
+ * of roughly 'color'. The same seed always gives the same pieces. */
+void spawnDebris (Debris& debris, glm::vec3 center, float size, glm::vec3 color, unsigned seed);
+
+/* Advance every fragment by dt, spread over the job workers when there
+ * are enough of them, then drop those that fell out of sight */
+void updateDebris (Debris& debris, float dt, float gravity);
+
+/* Per-fragment offsets and colors for one instanced draw */
+void debrisInstances (const Debris& debris, std::vector<TileInstance>& instances);
+
+void clearDebris (Debris& debris);
+
+#endif
@@ -0,0 +1,189 @@
+#include <string.h>
+#include "entities.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+using namespace std;
+
+int addEntity (EntityStore& store, glm::vec3 position, glm::vec4 rotation, glm::vec3 scale)
+{
+  store.px.push_back(position.x);
+  store.py.push_back(position.y);
+  store.pz.push_back(position.z);
+  store.qx.push_back(rotation.x);
+  store.qy.push_back(rotation.y);
+  store.qz.push_back(rotation.z);
+  store.qw.push_back(rotation.w);
+  store.sx.push_back(scale.x);
+  store.sy.push_back(scale.y);
+  store.sz.push_back(scale.z);
+  return store.px.size() - 1;
+}
+
+void clearEntities (EntityStore& store)
+{
+  store.px.clear(); store.py.clear(); store.pz.clear();
+  store.qx.clear(); store.qy.clear(); store.qz.clear(); store.qw.clear();
+  store.sx.clear(); store.sy.clear(); store.sz.clear();
+}
+
+/* Entities [first,last) one at a time; also finishes off the SIMD loops */
+static void buildModelsScalar (const EntityStore& s, glm::mat4* models, int first, int last)
+{
+  for (int i=first; i<last; i++) {
+    float x = s.qx[i], y = s.qy[i], z = s.qz[i], w = s.qw[i];
+    float* m = &models[i][0][0];
+    m[0] = (1 - 2*(y*y + z*z)) * s.sx[i];
+    m[1] = 2*(x*y + w*z) * s.sx[i];
+    m[2] = 2*(x*z - w*y) * s.sx[i];
+    m[3] = 0;
+    m[4] = 2*(x*y - w*z) * s.sy[i];
+    m[5] = (1 - 2*(x*x + z*z)) * s.sy[i];
+    m[6] = 2*(y*z + w*x) * s.sy[i];
+    m[7] = 0;
+    m[8] = 2*(x*z + w*y) * s.sz[i];
+    m[9] = 2*(y*z - w*x) * s.sz[i];
+    m[10] = (1 - 2*(x*x + y*y)) * s.sz[i];
+    m[11] = 0;
+    m[12] = s.px[i];
+    m[13] = s.py[i];
+    m[14] = s.pz[i];
+    m[15] = 1;
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* Four entities per step: the twelve non-constant matrix entries are
+ * computed for all four in SSE registers, then transposed into place */
+static void buildModelsSSE (const EntityStore& s, glm::mat4* models, int n)
+{
+  const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2), zero = _mm_setzero_ps();
+  int i = 0;
+  for (; i+4<=n; i+=4) {
+    __m128 x = _mm_loadu_ps(&s.qx[i]), y = _mm_loadu_ps(&s.qy[i]), z = _mm_loadu_ps(&s.qz[i]), w = _mm_loadu_ps(&s.qw[i]);
+    __m128 sx = _mm_loadu_ps(&s.sx[i]), sy = _mm_loadu_ps(&s.sy[i]), sz = _mm_loadu_ps(&s.sz[i]);
+    __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+    __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+    __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+    __m128 c[4][4];
+    c[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+    c[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+    c[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+    c[0][3] = zero;
+    c[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+    c[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+    c[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+    c[1][3] = zero;
+    c[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+    c[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+    c[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+    c[2][3] = zero;
+    c[3][0] = _mm_loadu_ps(&s.px[i]);
+    c[3][1] = _mm_loadu_ps(&s.py[i]);
+    c[3][2] = _mm_loadu_ps(&s.pz[i]);
+    c[3][3] = one;
+
+    // c[col][row] holds that entry for entities i..i+3; transpose each
+    // column so lane k becomes column 'col' of entity i+k
+    for (int col=0; col<4; col++) {
+      __m128 r0 = c[col][0], r1 = c[col][1], r2 = c[col][2], r3 = c[col][3];
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(&models[i][col][0], r0);
+      _mm_storeu_ps(&models[i+1][col][0], r1);
+      _mm_storeu_ps(&models[i+2][col][0], r2);
+      _mm_storeu_ps(&models[i+3][col][0], r3);
+    }
+  }
+  buildModelsScalar(s, models, i, n);
+}
+
+/* Eight entities per step; the transpose is done per 128-bit half */
+__attribute__((target("avx2,fma")))
+static void buildModelsAVX2 (const EntityStore& s, glm::mat4* models, int n)
+{
+  const __m256 one = _mm256_set1_ps(1), two = _mm256_set1_ps(2), zero = _mm256_setzero_ps();
+  int i = 0;
+  for (; i+8<=n; i+=8) {
+    __m256 x = _mm256_loadu_ps(&s.qx[i]), y = _mm256_loadu_ps(&s.qy[i]), z = _mm256_loadu_ps(&s.qz[i]), w = _mm256_loadu_ps(&s.qw[i]);
+    __m256 sx = _mm256_loadu_ps(&s.sx[i]), sy = _mm256_loadu_ps(&s.sy[i]), sz = _mm256_loadu_ps(&s.sz[i]);
+    __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+    __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+    __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+    __m256 c[4][4];
+    c[0][0] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+    c[0][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+    c[0][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+    c[0][3] = zero;
+    c[1][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+    c[1][1] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+    c[1][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+    c[1][3] = zero;
+    c[2][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+    c[2][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+    c[2][2] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+    c[2][3] = zero;
+    c[3][0] = _mm256_loadu_ps(&s.px[i]);
+    c[3][1] = _mm256_loadu_ps(&s.py[i]);
+    c[3][2] = _mm256_loadu_ps(&s.pz[i]);
+    c[3][3] = one;
+
+    for (int col=0; col<4; col++) {
+      for (int half=0; half<2; half++) {
+        __m128 r0, r1, r2, r3;
+        if (half == 0) {
+          r0 = _mm256_castps256_ps128(c[col][0]); r1 = _mm256_castps256_ps128(c[col][1]);
+          r2 = _mm256_castps256_ps128(c[col][2]); r3 = _mm256_castps256_ps128(c[col][3]);
+        } else {
+          r0 = _mm256_extractf128_ps(c[col][0], 1); r1 = _mm256_extractf128_ps(c[col][1], 1);
+          r2 = _mm256_extractf128_ps(c[col][2], 1); r3 = _mm256_extractf128_ps(c[col][3], 1);
+        }
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        int e = i + 4*half;
+        _mm_storeu_ps(&models[e][col][0], r0);
+        _mm_storeu_ps(&models[e+1][col][0], r1);
+        _mm_storeu_ps(&models[e+2][col][0], r2);
+        _mm_storeu_ps(&models[e+3][col][0], r3);
+      }
+    }
+  }
+  buildModelsScalar(s, models, i, n);
+}
+
+#endif
+
+TransformKernel bestTransformKernel ()
+{
+#ifdef HAVE_X86_KERNELS
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return KERNEL_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return KERNEL_SSE;
+#endif
+  return KERNEL_SCALAR;
+}
+
+const char* transformKernelName (TransformKernel kernel)
+{
+  static const char* names[] = { "auto", "scalar", "sse", "avx2" };
+  return names[kernel];
+}
+
+void buildModelMatrices (const EntityStore& store, glm::mat4* models, TransformKernel kernel)
+{
+  static TransformKernel best = bestTransformKernel();
+  if (kernel == KERNEL_AUTO)
+    kernel = best;
+#ifdef HAVE_X86_KERNELS
+  if (kernel == KERNEL_AVX2)
+    return buildModelsAVX2(store, models, store.size());
+  if (kernel == KERNEL_SSE)
+    return buildModelsSSE(store, models, store.size());
+#endif
+  buildModelsScalar(store, models, 0, store.size());
+}
@@ -0,0 +1,39 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* Entity transforms stored as structure-of-arrays, so a batch kernel can
+ * load the same component of several entities with one vector load.
+ * Rotation is a unit quaternion (x,y,z,w); scale is per axis. */
+struct EntityStore {
+  std::vector<float> px, py, pz;
+  std::vector<float> qx, qy, qz, qw;
+  std::vector<float> sx, sy, sz;
+
+  int size () const { return px.size(); }
+};
+
+/* Append an entity; returns its index */
+int addEntity (EntityStore& store, glm::vec3 position, glm::vec4 rotation=glm::vec4(0,0,0,1), glm::vec3 scale=glm::vec3(1));
+void clearEntities (EntityStore& store);
+
+/* Which kernel buildModelMatrices uses */
+enum TransformKernel {
+  KERNEL_AUTO,    // the widest one this CPU supports
+  KERNEL_SCALAR,
+  KERNEL_SSE,     // 4 entities per step
+  KERNEL_AVX2     // 8 entities per step
+};
+
+/* Model matrix T*R*S of every entity into models[0..size) */
+void buildModelMatrices (const EntityStore& store, glm::mat4* models, TransformKernel kernel=KERNEL_AUTO);
+
+/* Kernel KERNEL_AUTO picks, and its name */
+TransformKernel bestTransformKernel ();
+const char* transformKernelName (TransformKernel kernel);
+
+#endif
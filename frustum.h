@@ -0,0 +1,41 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* The six clip planes of a view-projection matrix, each stored as
+ * (normal, distance) with the normal pointing into the frustum */
+struct Frustum {
+  glm::vec4 planes[6];
+};
+
+/* Extract the planes from the rows of VP (Gribb & Hartmann) */
+inline Frustum frustumFromMatrix (const glm::mat4& VP)
+{
+  Frustum f;
+  glm::vec4 rows[4];
+  for (int r=0; r<4; r++)
+    rows[r] = glm::vec4(VP[0][r], VP[1][r], VP[2][r], VP[3][r]);
+  for (int axis=0; axis<3; axis++) {
+    f.planes[axis*2] = rows[3] + rows[axis];
+    f.planes[axis*2 + 1] = rows[3] - rows[axis];
+  }
+  return f;
+}
+
+/* False only if the box lies entirely outside one of the planes. May
+ * report a box near a frustum corner as visible, which is harmless. */
+inline bool boxVisible (const Frustum& f, const glm::vec3& lo, const glm::vec3& hi)
+{
+  for (int p=0; p<6; p++) {
+    const glm::vec4& plane = f.planes[p];
+    // The box corner farthest along the plane normal
+    glm::vec3 corner(plane.x >= 0 ? hi.x : lo.x, plane.y >= 0 ? hi.y : lo.y, plane.z >= 0 ? hi.z : lo.z);
+    if (plane.x*corner.x + plane.y*corner.y + plane.z*corner.z + plane.w < 0)
+      return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "block.h"
+#include "solver.h"
+#include "generator.h"
+
+using namespace std;
+
+/* Small fast PRNG (xorshift64*) so every worker has its own stream */
+struct Random {
+  unsigned long long state;
+
+  Random(unsigned long long seed) : state(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+
+  unsigned next ()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (unsigned) ((state * 2685821657736338717ULL) >> 32);
+  }
+
+  int below (int n) { return next() % n; }
+  bool chance (float p) { return (next() >> 8) < p * (1 << 24); }
+};
+
+/* Mix the run seed with the level index and attempt number */
+static unsigned long long levelSeed (unsigned seed, int index, int attempt)
+{
+  unsigned long long h = seed * 0x9e3779b97f4a7c15ULL;
+  h ^= (unsigned long long) index * 0xbf58476d1ce4e5b9ULL;
+  h ^= (unsigned long long) attempt * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+static inline bool insideGrid (const GeneratorParams& params, BlockState s)
+{
+  int x2 = s.orient == ORIENT_LYING_X ? s.x + 1 : s.x;
+  int z2 = s.orient == ORIENT_LYING_Z ? s.z + 1 : s.z;
+  return s.x >= 0 && s.z >= 0 && x2 < params.width && z2 < params.depth;
+}
+
+/* Index of cell (x,z) in a grid w cells wide, in size_t so that huge
+ * levels do not overflow */
+static inline size_t cellIndex (int x, int z, int w)
+{
+  return (size_t) z*w + x;
+}
+
+/* Lay tiles along a random walk, then scatter decoys next to it.
+ * Cells the walk only ever crossed lying down may become breakable. */
+static void layTiles (const GeneratorParams& params, Random& random, Level& level)
+{
+  int w = params.width, d = params.depth;
+  vector<unsigned char> cells((size_t) w*d, TILE_EMPTY);
+  vector<unsigned char> stood((size_t) w*d, 0);
+
+  BlockState s;
+  s.x = random.below(w);
+  s.z = random.below(d);
+  s.orient = ORIENT_STANDING;
+  BlockState start = s;
+  cells[cellIndex(s.x, s.z, w)] = TILE_SOLID;
+  stood[cellIndex(s.x, s.z, w)] = 1;
+
+  long long steps = max(16LL, (long long) w*d/2);
+  for (long long i=0; i<steps; i++) {
+    BlockState n = step(s, (Move) random.below(4));
+    if (!insideGrid(params, n))
+      continue;
+    s = n;
+    cells[cellIndex(s.x, s.z, w)] = TILE_SOLID;
+    if (s.orient == ORIENT_STANDING)
+      stood[cellIndex(s.x, s.z, w)] = 1;
+    else
+      cells[cellIndex(s.orient == ORIENT_LYING_X ? s.x+1 : s.x, s.orient == ORIENT_LYING_Z ? s.z+1 : s.z, w)] = TILE_SOLID;
+  }
+
+  for (size_t i=0; i<cells.size(); i++) {
+    if (cells[i] == TILE_SOLID && !stood[i] && random.chance(0.3f))
+      cells[i] = TILE_BREAKABLE;
+  }
+  for (int z=0; z<d; z++) {
+    for (int x=0; x<w; x++) {
+      size_t i = cellIndex(x, z, w);
+      if (cells[i] != TILE_EMPTY)
+        continue;
+      bool next_to_path = (x > 0 && cells[i-1]) || (x+1 < w && cells[i+1])
+        || (z > 0 && cells[i-w]) || (z+1 < d && cells[i+w]);
+      if (next_to_path && random.chance(0.15f))
+        cells[i] = random.chance(0.25f) ? TILE_BREAKABLE : TILE_SOLID;
+    }
+  }
+
+  freeLevel(level);
+  level.width = w;
+  level.depth = d;
+  level.start_x = start.x;
+  level.start_z = start.z;
+  level.goal_x = -1;
+  level.goal_z = -1;
+  level.storage.swap(cells);
+  level.cells = &level.storage[0];
+}
+
+/* Shortest move count from the start to standing on every cell; -1 if
+ * the cell cannot be stood on */
+static void standingDistances (const Level& level, vector<int>& distance)
+{
+  int w = level.width;
+  vector<int> state_distance((size_t) w*level.depth*3, -1);
+  vector<BlockState> queue;
+  BlockState start = startState(level);
+  state_distance[cellIndex(start.x, start.z, w)*3 + start.orient] = 0;
+  queue.push_back(start);
+
+  distance.assign((size_t) w*level.depth, -1);
+  distance[cellIndex(start.x, start.z, w)] = 0;
+  for (size_t head=0; head<queue.size(); head++) {
+    BlockState s = queue[head];
+    int dist = state_distance[cellIndex(s.x, s.z, w)*3 + s.orient];
+    for (int m=0; m<4; m++) {
+      BlockState n = s;
+      if (stepBlock(level, n, (Move) m) != BLOCK_OK)
+        continue;
+      int& nd = state_distance[cellIndex(n.x, n.z, w)*3 + n.orient];
+      if (nd >= 0)
+        continue;
+      nd = dist + 1;
+      queue.push_back(n);
+      if (n.orient == ORIENT_STANDING)
+        distance[cellIndex(n.x, n.z, w)] = nd;
+    }
+  }
+}
+
+/* Attempts after which a level with no possible goal is given up on */
+#define GENERATOR_GIVE_UP 1000
+
+void generateLevel (const GeneratorParams& params, int index, GeneratedLevel& out)
+{
+  out.min_moves = -1;
+  out.attempts = 0;
+  out.met_target = false;
+
+  Level candidate;
+  vector<int> distance;
+  int attempts = max(1, params.max_attempts);
+  for (int attempt=0; attempt<max(attempts, GENERATOR_GIVE_UP); attempt++) {
+    // Past max_attempts, only keep going until some layout has a goal
+    if (attempt >= attempts && out.min_moves >= 0)
+      break;
+    Random random(levelSeed(params.seed, index, attempt));
+    layTiles(params, random, candidate);
+    standingDistances(candidate, distance);
+
+    // Put the goal on the solid cell that takes the most moves to stand on
+    long long goal = -1;
+    for (size_t i=0; i<distance.size(); i++) {
+      if (distance[i] > 0 && candidate.cells[i] == TILE_SOLID && (goal < 0 || distance[i] > distance[goal]))
+        goal = i;
+    }
+    out.attempts = attempt + 1;
+    if (goal < 0 || distance[goal] <= out.min_moves)
+      continue;
+
+    candidate.storage[goal] = TILE_GOAL;
+    candidate.goal_x = goal % candidate.width;
+    candidate.goal_z = goal / candidate.width;
+    out.min_moves = distance[goal];
+    out.level = std::move(candidate);
+    if (out.min_moves >= params.min_moves) {
+      out.met_target = true;
+      break;
+    }
+  }
+
+  if (out.min_moves < 0) {
+    fprintf(stderr, "generator: level %d found no goal in %d attempts\n", index, out.attempts);
+    return;
+  }
+
+  // Cross-check with the solver: the walk guarantees a solution exists
+  SolveResult check = solveLevel(out.level, 1);
+  if (!check.solved || (int) check.moves.size() != out.min_moves) {
+    fprintf(stderr, "generator: level %d failed its solvability check\n", index);
+    out.min_moves = check.solved ? check.moves.size() : -1;
+  }
+}
+
+vector<GeneratedLevel> generateLevels (const GeneratorParams& params, int count, int threads)
+{
+  if (threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+
+  vector<GeneratedLevel> levels(count);
+  atomic<int> cursor(0);
+  auto worker = [&] () {
+    for (int i = cursor++; i < count; i = cursor++)
+      generateLevel(params, i, levels[i]);
+  };
+  vector<thread> workers;
+  for (int t=1; t<threads; t++)
+    workers.push_back(thread(worker));
+  worker();
+  for (size_t t=0; t<workers.size(); t++)
+    workers[t].join();
+  return levels;
+}
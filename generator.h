@@ -0,0 +1,32 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <vector>
+#include "level.h"
+
+struct GeneratorParams {
+  int width, depth;
+  int min_moves;        // difficulty target: shortest solution at least this long
+  unsigned seed;
+  int max_attempts;     // layouts tried per level before settling for the hardest
+};
+
+struct GeneratedLevel {
+  Level level;
+  int min_moves;        // length of the shortest solution
+  int attempts;
+  bool met_target;
+};
+
+/* Build one level. Tiles are laid under a random walk of the block, so
+ * the goal is always reachable; the goal is then put on the standing
+ * cell farthest (in moves) from the start. The same params and index
+ * always give the same level. Grids under 3x3 leave no room for a goal;
+ * if no layout gets one, min_moves is -1 and the level is empty. */
+void generateLevel (const GeneratorParams& params, int index, GeneratedLevel& out);
+
+/* Generate levels 0..count-1 on 'threads' workers (0 picks the hardware
+ * thread count) */
+std::vector<GeneratedLevel> generateLevels (const GeneratorParams& params, int count, int threads=0);
+
+#endif
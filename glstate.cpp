@@ -0,0 +1,108 @@
+#include "mesh.h"
+#include "glstate.h"
+
+/* Uniform block bindings tracked; ViewBlock uses 0 */
+#define UNIFORM_BINDINGS 4
+
+struct UniformRange {
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr size;
+};
+
+/* Each value is only trusted while its known_ flag is set */
+static struct {
+  GLuint program, vertex_array;
+  GLenum polygon_mode;
+  GLint viewport[4];
+  UniformRange uniforms[UNIFORM_BINDINGS];
+  bool known_program, known_vertex_array, known_polygon_mode, known_viewport;
+  bool known_uniforms[UNIFORM_BINDINGS];
+} state;
+static bool cache_on = true;
+
+/* Count the call and say whether it has to reach GL */
+static bool changes (bool same)
+{
+  if (same) {
+    render_stats.state_redundant++;
+    if (cache_on)
+      return false;
+  }
+  render_stats.state_calls++;
+  return true;
+}
+
+void resetGLState ()
+{
+  state.known_program = state.known_vertex_array = false;
+  state.known_polygon_mode = state.known_viewport = false;
+  for (int i=0; i<UNIFORM_BINDINGS; i++)
+    state.known_uniforms[i] = false;
+}
+
+void setGLStateCache (bool on)
+{
+  cache_on = on;
+}
+
+void useProgram (GLuint program)
+{
+  if (!changes(state.known_program && state.program == program))
+    return;
+  glUseProgram(program);
+  state.program = program;
+  state.known_program = true;
+}
+
+void bindVertexArray (GLuint vertex_array)
+{
+  if (!changes(state.known_vertex_array && state.vertex_array == vertex_array))
+    return;
+  glBindVertexArray(vertex_array);
+  state.vertex_array = vertex_array;
+  state.known_vertex_array = true;
+}
+
+void deleteVertexArray (GLuint vertex_array)
+{
+  // GL unbinds a deleted vertex array, and may hand its name out again
+  if (state.vertex_array == vertex_array)
+    state.known_vertex_array = false;
+  glDeleteVertexArrays(1, &vertex_array);
+}
+
+void setPolygonMode (GLenum mode)
+{
+  if (!changes(state.known_polygon_mode && state.polygon_mode == mode))
+    return;
+  glPolygonMode(GL_FRONT_AND_BACK, mode);
+  state.polygon_mode = mode;
+  state.known_polygon_mode = true;
+}
+
+void setViewport (GLint x, GLint y, GLsizei width, GLsizei height)
+{
+  GLint* v = state.viewport;
+  if (!changes(state.known_viewport && v[0] == x && v[1] == y && v[2] == width && v[3] == height))
+    return;
+  glViewport(x, y, width, height);
+  v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+  state.known_viewport = true;
+}
+
+void bindUniformRange (GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  if (index >= UNIFORM_BINDINGS) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    return;
+  }
+  UniformRange& range = state.uniforms[index];
+  if (!changes(state.known_uniforms[index] && range.buffer == buffer && range.offset == offset && range.size == size))
+    return;
+  glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+  range.buffer = buffer;
+  range.offset = offset;
+  range.size = size;
+  state.known_uniforms[index] = true;
+}
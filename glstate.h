@@ -0,0 +1,29 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+/* Shadow copy of the GL state that changes between draws: program,
+ * vertex array, polygon mode, viewport and the uniform block ranges.
+ * A call that would set what is already set is dropped, and counted in
+ * render_stats. Anything that binds or deletes these objects must go
+ * through here, or the copy goes stale. Main thread only. */
+
+/* Forget the copy, so that every next call reaches GL; call once the
+ * context is created */
+void resetGLState ();
+/* With the cache off every call reaches GL, but repeats are still
+ * counted, to measure what the cache saves */
+void setGLStateCache (bool on);
+
+void useProgram (GLuint program);
+void bindVertexArray (GLuint vertex_array);
+/* Delete a vertex array, forgetting it if it is the bound one */
+void deleteVertexArray (GLuint vertex_array);
+void setPolygonMode (GLenum mode);
+void setViewport (GLint x, GLint y, GLsizei width, GLsizei height);
+/* glBindBufferRange on GL_UNIFORM_BUFFER binding 'index' */
+void bindUniformRange (GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+#endif
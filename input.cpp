@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include "input.h"
+
+using namespace std;
+
+static FILE* input_log = NULL;
+
+bool openInputLog (const char* path, unsigned long long level_hash)
+{
+  input_log = fopen(path, "wb");
+  if (!input_log) {
+    fprintf(stderr, "Cannot write input log %s\n", path);
+    return false;
+  }
+  InputLogHeader header;
+  memcpy(header.magic, "BLKI", 4);
+  header.version = INPUT_LOG_VERSION;
+  header.level_hash = level_hash;
+  fwrite(&header, sizeof(header), 1, input_log);
+  fflush(input_log);
+  return true;
+}
+
+void writeInputEvent (const InputEvent& event)
+{
+  if (!input_log)
+    return;
+  fwrite(&event, sizeof(event), 1, input_log);
+  fflush(input_log);
+}
+
+void closeInputLog ()
+{
+  if (input_log)
+    fclose(input_log);
+  input_log = NULL;
+}
+
+bool readInputLog (const char* path, vector<InputEvent>& events, unsigned long long& level_hash)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Cannot open input log %s\n", path);
+    return false;
+  }
+  InputLogHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, "BLKI", 4) != 0) {
+    fprintf(stderr, "%s is not an input log\n", path);
+    fclose(f);
+    return false;
+  }
+  if (header.version != INPUT_LOG_VERSION) {
+    fprintf(stderr, "%s: unsupported input log version %d\n", path, header.version);
+    fclose(f);
+    return false;
+  }
+  level_hash = header.level_hash;
+
+  InputEvent event;
+  events.clear();
+  while (fread(&event, sizeof(event), 1, f) == 1)
+    events.push_back(event);
+  fclose(f);
+  return true;
+}
@@ -0,0 +1,40 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <vector>
+
+/* Input recording. Every key and mouse event is stamped with the
+ * simulation tick it is applied before, so feeding a log back into the
+ * same level reproduces a session exactly, at any frame rate or with no
+ * rendering at all. */
+
+enum InputEventType {
+  INPUT_KEY = 0,
+  INPUT_MOUSE = 1
+};
+
+struct InputEvent {
+  unsigned int tick;     // simulation tick (SIM_DT each) it applies before
+  unsigned char type;    // InputEventType
+  unsigned char action;  // GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+  short code;            // GLFW key or mouse button
+};
+
+/* Log file: this header followed by InputEvents in tick order, up to the
+ * end of the file (a log cut short by a crash stays readable) */
+struct InputLogHeader {
+  char magic[4];  // "BLKI"
+  int version;
+  unsigned long long level_hash;  // levelHash() of the level played
+};
+
+#define INPUT_LOG_VERSION 1
+
+/* Start a log; events are flushed as they are written */
+bool openInputLog (const char* path, unsigned long long level_hash);
+void writeInputEvent (const InputEvent& event);
+void closeInputLog ();
+
+bool readInputLog (const char* path, std::vector<InputEvent>& events, unsigned long long& level_hash);
+
+#endif
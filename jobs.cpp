@@ -0,0 +1,294 @@
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include "profiler.h"
+#include "alloc.h"
+#include "jobs.h"
+
+using namespace std;
+
+struct Job {
+  const char* name;
+  function<void()> fn;
+  JobCounter* done;
+};
+
+/* A worker's own jobs in a ring: the owner works at the back, thieves at
+ * the front. The ring only grows, when it is full, so once it has room
+ * for a frame's jobs queueing them costs no heap. */
+#define WORKER_RING 256
+
+struct Worker {
+  mutex m;
+  vector<Job*> ring;    // a power of two in size
+  size_t head, tail;    // the jobs are ring[head..tail), wrapped
+
+  Worker () : ring(WORKER_RING), head(0), tail(0) {}
+
+  bool empty () const { return head == tail; }
+  void pushBack (Job* job)
+  {
+    if (tail - head == ring.size()) {
+      vector<Job*> bigger(ring.size()*2);
+      for (size_t i=head; i<tail; i++)
+        bigger[i - head] = ring[i & (ring.size() - 1)];
+      ring.swap(bigger);
+      tail -= head;
+      head = 0;
+    }
+    ring[tail++ & (ring.size() - 1)] = job;
+  }
+  Job* popBack () { return ring[--tail & (ring.size() - 1)]; }
+  Job* popFront () { return ring[head++ & (ring.size() - 1)]; }
+};
+
+struct JobStat {
+  long long count;
+  double total_us, max_us;
+};
+
+static vector<Worker*> workers;   // workers[0] is the main thread; only
+                                  // jobsStart and jobsStop change it
+static vector<thread> worker_threads;
+static thread_local int worker_id = -1;
+
+/* Idle workers sleep until something is queued */
+static mutex sleep_mutex;
+static condition_variable wake;
+static atomic<int> queued(0);
+static atomic<unsigned> next_worker(0);
+static bool stopping = false;
+
+static mutex stats_mutex;
+static unordered_map<const char*, JobStat> job_stats;
+
+/* Finished jobs are kept for reuse, so a frame's jobs cost no heap */
+static mutex free_mutex;
+static vector<Job*> free_jobs;
+
+static Job* newJob ()
+{
+  lock_guard<mutex> lock(free_mutex);
+  if (free_jobs.empty())
+    return new Job;
+  Job* job = free_jobs.back();
+  free_jobs.pop_back();
+  return job;
+}
+
+static void freeJob (Job* job)
+{
+  job->fn = nullptr;
+  lock_guard<mutex> lock(free_mutex);
+  free_jobs.push_back(job);
+}
+
+static void pushJob (Job* job)
+{
+  // Workers keep their own jobs; other threads spread theirs round-robin
+  int w = worker_id >= 0 ? worker_id : next_worker++ % workers.size();
+  {
+    lock_guard<mutex> lock(workers[w]->m);
+    workers[w]->pushBack(job);
+  }
+  queued++;
+  lock_guard<mutex> lock(sleep_mutex);
+  wake.notify_one();
+}
+
+/* The newest job of this worker, or failing that the oldest job of
+ * another one */
+static Job* takeJob (int self)
+{
+  Job* job = NULL;
+  {
+    lock_guard<mutex> lock(workers[self]->m);
+    if (!workers[self]->empty())
+      job = workers[self]->popBack();
+  }
+  int n = workers.size();
+  for (int k=1; k<n && !job; k++) {
+    Worker* victim = workers[(self + k) % n];
+    lock_guard<mutex> lock(victim->m);
+    if (!victim->empty())
+      job = victim->popFront();
+  }
+  if (job)
+    queued--;
+  return job;
+}
+
+/* Lower a counter and release the jobs waiting on it. The count only
+ * changes under the counter's lock, so once a waiter has seen zero and
+ * taken the lock nothing touches the counter again. */
+static void finishCounter (JobCounter& counter)
+{
+  vector<Job*> ready;
+  {
+    lock_guard<mutex> lock(counter.m);
+    if (--counter.count == 0)
+      ready.swap(counter.waiting);
+  }
+  for (size_t i=0; i<ready.size(); i++)
+    pushJob(ready[i]);
+}
+
+/* Run fn, timing it on the calling thread's track and counting its
+ * allocations against the job's name */
+static void timeJob (const char* name, const function<void()>& fn)
+{
+  const char* prev_tag = allocSetTag(name);
+  double start = profilerNow();
+  fn();
+  double us = profilerNow() - start;
+  profilerRecord(name, worker_id <= 0 ? TRACK_CPU : TRACK_WORKER + worker_id - 1, start, us);
+
+  lock_guard<mutex> lock(stats_mutex);
+  JobStat& stat = job_stats[name];
+  stat.count++;
+  stat.total_us += us;
+  stat.max_us = max(stat.max_us, us);
+  allocSetTag(prev_tag);
+}
+
+static void runJob (Job* job)
+{
+  timeJob(job->name, job->fn);
+  if (job->done)
+    finishCounter(*job->done);
+  freeJob(job);
+}
+
+static void workerThread (int self)
+{
+  worker_id = self;
+  for (;;) {
+    Job* job = takeJob(self);
+    if (job) {
+      runJob(job);
+      continue;
+    }
+    unique_lock<mutex> lock(sleep_mutex);
+    wake.wait(lock, [] () { return stopping || queued > 0; });
+    if (stopping)
+      return;
+  }
+}
+
+void jobsStart (int threads)
+{
+  if (threads <= 0)
+    threads = (int) thread::hardware_concurrency() - 1;
+  stopping = false;
+  worker_id = 0;
+  for (int w=0; w<=max(threads, 0); w++)
+    workers.push_back(new Worker);
+  for (int w=1; w<=threads; w++)
+    worker_threads.push_back(thread(workerThread, w));
+}
+
+void jobsStop ()
+{
+  {
+    lock_guard<mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t t=0; t<worker_threads.size(); t++)
+    worker_threads[t].join();
+  worker_threads.clear();
+  for (size_t w=0; w<workers.size(); w++) {
+    while (!workers[w]->empty())
+      delete workers[w]->popFront();
+    delete workers[w];
+  }
+  workers.clear();
+  queued = 0;
+  lock_guard<mutex> lock(free_mutex);
+  for (size_t i=0; i<free_jobs.size(); i++)
+    delete free_jobs[i];
+  free_jobs.clear();
+}
+
+int jobWorkers ()
+{
+  return max((int) workers.size(), 1);
+}
+
+void jobRun (const char* name, const function<void()>& fn, JobCounter* done, JobCounter* after)
+{
+  // Without workers everything runs on the spot, so 'after' is already done
+  if (workers.empty()) {
+    timeJob(name, fn);
+    return;
+  }
+  Job* job = newJob();
+  job->name = name;
+  job->fn = fn;
+  job->done = done;
+  if (done) {
+    lock_guard<mutex> lock(done->m);
+    done->count++;
+  }
+  if (after) {
+    lock_guard<mutex> lock(after->m);
+    if (after->count > 0) {
+      after->waiting.push_back(job);
+      return;
+    }
+  }
+  pushJob(job);
+}
+
+void jobWait (JobCounter& counter)
+{
+  while (counter.count > 0) {
+    Job* job = worker_id >= 0 && !workers.empty() ? takeJob(worker_id) : NULL;
+    if (job)
+      runJob(job);
+    else
+      this_thread::yield();
+  }
+  lock_guard<mutex> lock(counter.m);
+}
+
+void parallelFor (const char* name, int n, int grain, const function<void(int,int)>& body)
+{
+  if (n <= 0)
+    return;
+  if (n <= grain || jobWorkers() == 1) {
+    timeJob(name, [&] () { body(0, n); });
+    return;
+  }
+  // A few ranges per worker, so that stealing evens out uneven ones
+  int ranges = min((n + grain - 1) / grain, jobWorkers()*4);
+  JobCounter done;
+  for (int r=0; r<ranges; r++) {
+    int first = (long long) n*r/ranges;
+    int last = (long long) n*(r + 1)/ranges;
+    jobRun(name, [&body, first, last] () { body(first, last); }, &done);
+  }
+  jobWait(done);
+}
+
+void printJobStats (FILE* out)
+{
+  lock_guard<mutex> lock(stats_mutex);
+  vector<pair<double, const char*> > order;
+  for (auto it = job_stats.begin(); it != job_stats.end(); ++it)
+    order.push_back(make_pair(-it->second.total_us, it->first));
+  sort(order.begin(), order.end());
+  fprintf(out, "%-20s %9s %11s %9s %9s\n", "job", "runs", "total ms", "avg us", "max us");
+  for (size_t i=0; i<order.size(); i++) {
+    const JobStat& stat = job_stats[order[i].second];
+    fprintf(out, "%-20s %9lld %11.3f %9.2f %9.2f\n", order[i].second, stat.count,
+      stat.total_us/1000, stat.total_us/stat.count, stat.max_us);
+  }
+}
+
+void resetJobStats ()
+{
+  lock_guard<mutex> lock(stats_mutex);
+  job_stats.clear();
+}
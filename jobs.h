@@ -0,0 +1,58 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+/* Per-frame job system. Every worker thread owns a deque: it pushes and
+ * pops its own jobs at the back, and when it runs dry it steals from the
+ * front of another worker's deque. The main thread is worker 0 and
+ * helps run jobs whenever it waits for them. Each job run is recorded
+ * by the profiler on its worker's track and added to per-name totals.
+ *
+ * Loading stays on the loader threads: those jobs block on disk and
+ * would hold up frame work. */
+
+struct Job;
+
+/* Counts unfinished jobs. Jobs started with it as 'done' raise it when
+ * submitted and lower it when finished; jobs started with it as 'after'
+ * are held back until it reaches zero. The count only changes under 'm';
+ * it is atomic so that jobWait can poll it without the lock. A counter
+ * must outlive its jobs. */
+struct JobCounter {
+  std::atomic<int> count;
+  std::mutex m;
+  std::vector<Job*> waiting;
+
+  JobCounter () : count(0) {}
+};
+
+/* Start 'threads' workers besides the main thread (0 picks one fewer
+ * than the hardware thread count; may be none). Call on the main thread,
+ * before starting any other thread that queues jobs (the loader threads):
+ * the worker list is read without a lock. Stop those threads again
+ * before jobsStop. */
+void jobsStart (int threads=0);
+void jobsStop ();
+/* Worker threads plus the main thread */
+int jobWorkers ();
+
+/* Queue fn; 'name' must be a string literal */
+void jobRun (const char* name, const std::function<void()>& fn, JobCounter* done=NULL, JobCounter* after=NULL);
+/* Run jobs on this thread until 'counter' reaches zero */
+void jobWait (JobCounter& counter);
+
+/* Call body(first, last) over [0,n) in ranges of at least 'grain'
+ * items spread over the workers, and return when all are done. Runs
+ * inline when n fits in one range or there are no workers. */
+void parallelFor (const char* name, int n, int grain, const std::function<void(int,int)>& body);
+
+/* Count, total and longest run of every job name so far */
+void printJobStats (FILE* out);
+void resetJobStats ();
+
+#endif
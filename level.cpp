@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fstream>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "level.h"
+
+using namespace std;
+
+/* Text levels draw the grid one row of cells per line, z increasing
+ * downwards. Lines starting with ';' are comments. */
+static const char tile_chars[] = { '.', '#', 'B', 'G' };
+
+Level::Level (Level&& other) : cells(NULL), map(NULL), map_size(0)
+{
+  *this = std::move(other);
+}
+
+Level& Level::operator= (Level&& other)
+{
+  if (this == &other)
+    return *this;
+  freeLevel(*this);
+  width = other.width;
+  depth = other.depth;
+  start_x = other.start_x;
+  start_z = other.start_z;
+  goal_x = other.goal_x;
+  goal_z = other.goal_z;
+  storage.swap(other.storage);
+  map = other.map;
+  map_size = other.map_size;
+  cells = other.cells;  // a vector swap keeps its buffer, so this stays valid
+
+  other.map = NULL;
+  other.map_size = 0;
+  freeLevel(other);
+  return *this;
+}
+
+Level::~Level()
+{
+  freeLevel(*this);
+}
+
+void freeLevel (Level& level)
+{
+  if (level.map)
+    munmap(level.map, level.map_size);
+  level.map = NULL;
+  level.map_size = 0;
+  level.storage.clear();
+  level.cells = NULL;
+  level.width = level.depth = 0;
+  level.start_x = level.start_z = 0;
+  level.goal_x = level.goal_z = -1;
+}
+
+void setLevelTile (Level& level, int x, int z, unsigned char tile)
+{
+  if ((unsigned) x >= (unsigned) level.width || (unsigned) z >= (unsigned) level.depth)
+    return;
+  // A mapping is private, so writing a cell copies only the page it sits
+  // on and the file itself never changes
+  if (level.map)
+    ((unsigned char*) level.cells)[(size_t) z*level.width + x] = tile;
+  else
+    level.storage[(size_t) z*level.width + x] = tile;
+}
+
+unsigned long long levelHash (const Level& level)
+{
+  int fields[6] = { level.width, level.depth, level.start_x, level.start_z, level.goal_x, level.goal_z };
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned char* bytes = (const unsigned char*) fields;
+  for (size_t i=0; i<sizeof(fields); i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ULL;
+  }
+  for (size_t i=0; i<(size_t) level.width*level.depth; i++) {
+    h ^= level.cells[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+bool loadLevel (const char* path, Level& level)
+{
+  char magic[4] = {0};
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Cannot open level %s\n", path);
+    return false;
+  }
+  size_t n = fread(magic, 1, 4, f);
+  fclose(f);
+
+  if (n == 4 && memcmp(magic, "BLKL", 4) == 0)
+    return loadLevelBinary(path, level);
+  return loadLevelText(path, level);
+}
+
+bool loadLevelText (const char* path, Level& level)
+{
+  ifstream in(path);
+  if (!in.is_open()) {
+    fprintf(stderr, "Cannot open level %s\n", path);
+    return false;
+  }
+
+  vector<string> rows;
+  string line;
+  size_t width = 0;
+  while (getline(in, line)) {
+    if (!line.empty() && line[line.size()-1] == '\r')
+      line.erase(line.size()-1);
+    if (!line.empty() && line[0] == ';')
+      continue;
+    rows.push_back(line);
+    if (line.size() > width)
+      width = line.size();
+  }
+  while (!rows.empty() && rows.back().empty())
+    rows.pop_back();
+
+  freeLevel(level);
+  level.width = width;
+  level.depth = rows.size();
+  level.storage.assign(width*rows.size(), TILE_EMPTY);
+
+  bool has_start = false;
+  for (size_t z=0; z<rows.size(); z++) {
+    for (size_t x=0; x<rows[z].size(); x++) {
+      unsigned char& cell = level.storage[z*width + x];
+      switch (rows[z][x]) {
+        case '.': case ' ':
+        cell = TILE_EMPTY;
+        break;
+        case '#':
+        cell = TILE_SOLID;
+        break;
+        case 'S':
+        cell = TILE_SOLID;
+        level.start_x = x;
+        level.start_z = z;
+        has_start = true;
+        break;
+        case 'B':
+        cell = TILE_BREAKABLE;
+        break;
+        case 'G':
+        cell = TILE_GOAL;
+        level.goal_x = x;
+        level.goal_z = z;
+        break;
+        default:
+        fprintf(stderr, "%s:%d: unknown tile '%c'\n", path, (int)z+1, rows[z][x]);
+        freeLevel(level);
+        return false;
+      }
+    }
+  }
+  if (!has_start) {
+    fprintf(stderr, "%s: level has no start tile 'S'\n", path);
+    freeLevel(level);
+    return false;
+  }
+  level.cells = level.storage.empty() ? NULL : &level.storage[0];
+  return true;
+}
+
+bool saveLevelText (const char* path, const Level& level)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "Cannot write level %s\n", path);
+    return false;
+  }
+  string row(level.width, '.');
+  for (int z=0; z<level.depth; z++) {
+    for (int x=0; x<level.width; x++) {
+      unsigned char t = levelTile(level, x, z);
+      row[x] = t < sizeof(tile_chars) ? tile_chars[t] : '.';
+      if (x == level.start_x && z == level.start_z)
+        row[x] = 'S';
+    }
+    fprintf(f, "%s\n", row.c_str());
+  }
+  return fclose(f) == 0;
+}
+
+bool loadLevelBinary (const char* path, Level& level)
+{
+  freeLevel(level);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open level %s\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(LevelFileHeader)) {
+    fprintf(stderr, "%s: truncated level file\n", path);
+    close(fd);
+    return false;
+  }
+  // Pages are read in as chunks touch them and can be dropped again by
+  // the kernel, so a level far larger than memory still loads
+  void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: mmap failed\n", path);
+    return false;
+  }
+
+  const LevelFileHeader* header = (const LevelFileHeader*) map;
+  size_t cells = (size_t) header->width * header->depth;
+  if (memcmp(header->magic, "BLKL", 4) != 0 || header->version != LEVEL_FILE_VERSION
+      || header->width < 0 || header->depth < 0
+      || (size_t) st.st_size < sizeof(LevelFileHeader) + cells) {
+    fprintf(stderr, "%s: not a version %d level file\n", path, LEVEL_FILE_VERSION);
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  // Hold the file to what the text reader allows: every cell a known
+  // tile, the start on a tile and the goal, if any, on the hole. This
+  // reads every page once; the kernel can still drop them again.
+  const unsigned char* grid = (const unsigned char*) map + sizeof(LevelFileHeader);
+  const char* error = NULL;
+  unsigned char highest = 0;
+  for (size_t i=0; i<cells; i++)
+    highest = grid[i] > highest ? grid[i] : highest;
+  size_t bad = 0;
+  if (highest > TILE_GOAL) {
+    while (grid[bad] <= TILE_GOAL)
+      bad++;
+    error = "unknown tile";
+  }
+  else if ((unsigned) header->start_x >= (unsigned) header->width || (unsigned) header->start_z >= (unsigned) header->depth
+      || grid[(size_t) header->start_z*header->width + header->start_x] == TILE_EMPTY)
+    error = "start is not on a tile";
+  else if (!(header->goal_x == -1 && header->goal_z == -1)
+      && ((unsigned) header->goal_x >= (unsigned) header->width || (unsigned) header->goal_z >= (unsigned) header->depth
+        || grid[(size_t) header->goal_z*header->width + header->goal_x] != TILE_GOAL))
+    error = "goal is not on a goal tile";
+  if (error) {
+    if (highest > TILE_GOAL)
+      fprintf(stderr, "%s: %s %d at (%d,%d)\n", path, error, grid[bad], (int) (bad % header->width), (int) (bad / header->width));
+    else
+      fprintf(stderr, "%s: %s\n", path, error);
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  level.map = map;
+  level.map_size = st.st_size;
+  level.width = header->width;
+  level.depth = header->depth;
+  level.start_x = header->start_x;
+  level.start_z = header->start_z;
+  level.goal_x = header->goal_x;
+  level.goal_z = header->goal_z;
+  level.cells = grid;
+  return true;
+}
+
+bool saveLevelBinary (const char* path, const Level& level)
+{
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "Cannot write level %s\n", path);
+    return false;
+  }
+  LevelFileHeader header;
+  memcpy(header.magic, "BLKL", 4);
+  header.version = LEVEL_FILE_VERSION;
+  header.width = level.width;
+  header.depth = level.depth;
+  header.start_x = level.start_x;
+  header.start_z = level.start_z;
+  header.goal_x = level.goal_x;
+  header.goal_z = level.goal_z;
+
+  size_t cells = (size_t) level.width * level.depth;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+    && (cells == 0 || fwrite(level.cells, 1, cells, f) == cells);
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "Cannot write level %s\n", path);
+  return ok;
+}
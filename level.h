@@ -0,0 +1,74 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <stddef.h>
+#include <vector>
+
+/* What a grid cell holds. Anything but TILE_EMPTY carries the block. */
+enum TileType {
+  TILE_EMPTY = 0,
+  TILE_SOLID = 1,
+  TILE_BREAKABLE = 2,  // collapses under a standing block
+  TILE_GOAL = 3        // the hole: a standing block drops through it
+};
+
+/* A level is a width x depth byte grid, one byte per cell, row-major
+ * along z (cell (x,z) is cells[z*width + x]). Cells either live in
+ * 'storage' (text levels) or point straight into a private
+ * copy-on-write mapping of a binary level file. */
+struct Level {
+  int width, depth;
+  int start_x, start_z;
+  int goal_x, goal_z;
+  const unsigned char* cells;
+
+  std::vector<unsigned char> storage;
+  void* map;
+  size_t map_size;
+
+  Level() : width(0), depth(0), start_x(0), start_z(0), goal_x(-1), goal_z(-1), cells(NULL), map(NULL), map_size(0) {}
+  Level(Level&& other);
+  Level& operator= (Level&& other);
+  ~Level();
+
+  // 'cells' may point into 'storage' or 'map', so levels are moved, never copied
+  Level(const Level&) = delete;
+  Level& operator= (const Level&) = delete;
+};
+
+/* Binary level file: this header followed by width*depth tile bytes */
+struct LevelFileHeader {
+  char magic[4];  // "BLKL"
+  int version;
+  int width, depth;
+  int start_x, start_z;
+  int goal_x, goal_z;
+};
+
+#define LEVEL_FILE_VERSION 1
+
+/* Tile at (x,z); everything outside the grid is empty */
+inline unsigned char levelTile (const Level& level, int x, int z)
+{
+  if ((unsigned) x >= (unsigned) level.width || (unsigned) z >= (unsigned) level.depth)
+    return TILE_EMPTY;
+  return level.cells[(size_t) z*level.width + x];
+}
+
+/* Change one cell in place (tiles collapsing during play). A mapped
+ * level only gets a private copy of the page holding the cell. */
+void setLevelTile (Level& level, int x, int z, unsigned char tile);
+
+/* Load a level, picking the text or binary reader from the file contents.
+ * Errors are reported on stderr and leave 'level' empty. */
+bool loadLevel (const char* path, Level& level);
+bool loadLevelText (const char* path, Level& level);
+bool loadLevelBinary (const char* path, Level& level);
+bool saveLevelBinary (const char* path, const Level& level);
+bool saveLevelText (const char* path, const Level& level);
+void freeLevel (Level& level);
+
+/* 64-bit FNV-1a of the size, start, goal and cells, to tell levels apart */
+unsigned long long levelHash (const Level& level);
+
+#endif
@@ -0,0 +1,118 @@
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "profiler.h"
+#include "loader.h"
+
+using namespace std;
+
+static mutex loader_mutex;
+static condition_variable job_ready, upload_ready;
+static deque<function<void()> > jobs, uploads;
+static vector<thread> loader_threads;
+static int jobs_running = 0;
+static bool stopping = false;
+
+static void loaderThread ()
+{
+  unique_lock<mutex> lock(loader_mutex);
+  for (;;) {
+    job_ready.wait(lock, [] () { return stopping || !jobs.empty(); });
+    if (stopping)
+      return;
+    function<void()> job = jobs.front();
+    jobs.pop_front();
+    jobs_running++;
+    lock.unlock();
+
+    double start = profilerNow();
+    job();
+    profilerRecord("load.job", TRACK_CPU, start, profilerNow() - start);
+
+    lock.lock();
+    jobs_running--;
+    upload_ready.notify_all();
+  }
+}
+
+void loaderStart (int threads)
+{
+  if (threads <= 0)
+    threads = max(1, (int) thread::hardware_concurrency() - 1);
+  stopping = false;
+  for (int t=0; t<threads; t++)
+    loader_threads.push_back(thread(loaderThread));
+}
+
+void loaderStop ()
+{
+  {
+    lock_guard<mutex> lock(loader_mutex);
+    stopping = true;
+  }
+  job_ready.notify_all();
+  for (size_t t=0; t<loader_threads.size(); t++)
+    loader_threads[t].join();
+  loader_threads.clear();
+  jobs.clear();
+  uploads.clear();
+}
+
+void loaderSubmit (const function<void()>& job)
+{
+  {
+    lock_guard<mutex> lock(loader_mutex);
+    jobs.push_back(job);
+  }
+  job_ready.notify_one();
+}
+
+void loaderUpload (const function<void()>& upload)
+{
+  {
+    lock_guard<mutex> lock(loader_mutex);
+    uploads.push_back(upload);
+  }
+  upload_ready.notify_all();
+}
+
+int loaderProcessUploads (double budget)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int count = 0;
+  for (;;) {
+    function<void()> upload;
+    {
+      lock_guard<mutex> lock(loader_mutex);
+      if (uploads.empty())
+        break;
+      upload = uploads.front();
+      uploads.pop_front();
+    }
+    upload();
+    count++;
+    if (chrono::duration<double>(chrono::steady_clock::now() - start).count() >= budget)
+      break;
+  }
+  return count;
+}
+
+bool loaderIdle ()
+{
+  lock_guard<mutex> lock(loader_mutex);
+  return jobs.empty() && jobs_running == 0 && uploads.empty();
+}
+
+void loaderFinish ()
+{
+  for (;;) {
+    loaderProcessUploads(1e9);
+    unique_lock<mutex> lock(loader_mutex);
+    if (jobs.empty() && jobs_running == 0 && uploads.empty())
+      return;
+    upload_ready.wait(lock, [] () { return !uploads.empty() || (jobs.empty() && jobs_running == 0); });
+  }
+}
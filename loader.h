@@ -0,0 +1,29 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <functional>
+
+/* Background asset loading. Jobs run on a pool of loader threads and do
+ * the file reading and CPU-side mesh building; anything that needs the
+ * GL context is queued back with loaderUpload and run on the main
+ * thread by loaderProcessUploads, a few at a time between frames. */
+
+/* Start 'threads' loader threads (0 picks one fewer than the hardware
+ * thread count, at least one) */
+void loaderStart (int threads=0);
+void loaderStop ();
+
+/* Run 'job' on a loader thread; callable from any thread */
+void loaderSubmit (const std::function<void()>& job);
+/* Run 'upload' on the main thread; callable from any thread */
+void loaderUpload (const std::function<void()>& upload);
+
+/* Run queued uploads until 'budget' seconds have passed; returns how
+ * many ran. Main thread only. */
+int loaderProcessUploads (double budget);
+/* True once no job is queued or running and no upload is waiting */
+bool loaderIdle ();
+/* Run uploads as they arrive until the loader is idle. Main thread only. */
+void loaderFinish ();
+
+#endif
@@ -0,0 +1,355 @@
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
+#include <unordered_map>
+#include "mesh.h"
+#include "glstate.h"
+
+using namespace std;
+
+RenderStats render_stats;
+
+const VertexLayout LAYOUT_FLOAT = {
+  { 3, GL_FLOAT, GL_FALSE, 0 },
+  { 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat) },
+  6*sizeof(GLfloat)
+};
+
+const VertexLayout LAYOUT_PACKED = {
+  { 3, GL_HALF_FLOAT, GL_FALSE, 0 },
+  { 3, GL_UNSIGNED_BYTE, GL_TRUE, 4*sizeof(GLushort) },
+  4*sizeof(GLushort) + 4
+};
+
+/* Registered mesh together with the packed data it was built from,
+ * kept so that a hash match can be confirmed before sharing the handle */
+struct MeshRecord {
+  struct VAO* vao;
+  MeshData data;
+};
+
+static unordered_multimap<unsigned long long, MeshRecord> mesh_registry;
+
+/* 64-bit FNV-1a over raw bytes */
+static unsigned long long hashBytes (const void* data, size_t size, unsigned long long h)
+{
+  const unsigned char* p = (const unsigned char*) data;
+  for (size_t i=0; i<size; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* IEEE half float nearest to f. Values too small for a normal half
+ * become zero and values too large become infinity. */
+static GLushort floatToHalf (float f)
+{
+  unsigned int x;
+  memcpy(&x, &f, sizeof(x));
+  unsigned int sign = (x >> 16) & 0x8000;
+  int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+  unsigned int mantissa = x & 0x7fffff;
+  if (exponent <= 0)
+    return sign;
+  if (exponent >= 31)
+    return sign | 0x7c00;
+  // Round to nearest; a carry out of the mantissa correctly bumps the exponent
+  return (sign | (exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+}
+
+/* Store the components of one attribute in its packed form */
+static void packAttribute (const VertexAttribute& attr, const GLfloat* v, unsigned char* out)
+{
+  for (int c=0; c<attr.size; c++) {
+    if (attr.type == GL_HALF_FLOAT) {
+      GLushort h = floatToHalf(v[c]);
+      memcpy(out + c*sizeof(GLushort), &h, sizeof(GLushort));
+    }
+    else if (attr.type == GL_UNSIGNED_BYTE)
+      out[c] = (unsigned char)(min(max(v[c], 0.0f), 1.0f)*255 + 0.5f);
+    else
+      memcpy(out + c*sizeof(GLfloat), &v[c], sizeof(GLfloat));
+  }
+}
+
+void appendVertices (MeshData& mesh, int n, const GLfloat* positions, const GLfloat* colors, glm::vec3 offset)
+{
+  const VertexLayout& layout = *mesh.layout;
+  unsigned char vertex[64];  // larger than any layout's stride
+  GLuint first = mesh.numVertices();
+
+  for (int i=0; i<n; i++) {
+    GLfloat p[3] = { positions[3*i] + offset.x, positions[3*i+1] + offset.y, positions[3*i+2] + offset.z };
+    memset(vertex, 0, layout.stride);
+    packAttribute(layout.position, p, vertex + layout.position.offset);
+    packAttribute(layout.color, &colors[3*i], vertex + layout.color.offset);
+
+    // Point at an identical vertex from earlier in the run, or add this one
+    GLuint index = mesh.numVertices();
+    for (GLuint k=first; k<index; k++) {
+      if (!memcmp(&mesh.vertices[k*layout.stride], vertex, layout.stride)) {
+        index = k;
+        break;
+      }
+    }
+    if (index == (GLuint) mesh.numVertices())
+      mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + layout.stride);
+    mesh.indices.push_back(index);
+  }
+}
+
+/* Point attributes 0 and 1 of the bound VAO at the bound vertex buffer */
+static void setVertexAttributes (const VertexLayout& layout)
+{
+  glVertexAttribPointer(
+                        0,                          // attribute 0. Vertices
+                        layout.position.size,       // size (x,y,z)
+                        layout.position.type,       // type
+                        layout.position.normalized, // normalized?
+                        layout.stride,              // stride
+                        (void*)(size_t)layout.position.offset // array buffer offset
+                        );
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(
+                        1,                          // attribute 1. Color
+                        layout.color.size,          // size (r,g,b)
+                        layout.color.type,          // type
+                        layout.color.normalized,    // normalized?
+                        layout.stride,              // stride
+                        (void*)(size_t)layout.color.offset // array buffer offset
+                        );
+  glEnableVertexAttribArray(1);
+}
+
+/* Fill the vertex and index buffers of vao, which must be bound. Indices
+ * go up as 16 bits whenever the vertices allow it. */
+static void uploadMeshData (struct VAO* vao, const MeshData& mesh, GLenum usage)
+{
+  vao->NumVertices = mesh.numVertices();
+  vao->NumIndices = mesh.indices.size();
+  vao->Layout = mesh.layout;
+
+  glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+  glBufferData (GL_ARRAY_BUFFER, mesh.vertices.size(), mesh.vertices.empty() ? NULL : &mesh.vertices[0], usage);
+
+  if (vao->NumVertices <= 65536) {
+    vector<GLushort> shorts(mesh.indices.begin(), mesh.indices.end());
+    vao->IndexType = GL_UNSIGNED_SHORT;
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, shorts.size()*sizeof(GLushort), shorts.empty() ? NULL : &shorts[0], usage);
+  }
+  else {
+    vao->IndexType = GL_UNSIGNED_INT;
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size()*sizeof(GLuint), &mesh.indices[0], usage);
+  }
+}
+
+/* Create the VAO with its vertex and index buffers for vao */
+static void setupVertexArray (struct VAO* vao, const MeshData& mesh, GLenum usage)
+{
+    // Create Vertex Array Object
+    // Should be done after CreateWindow and before any other GL calls
+  glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
+  glGenBuffers (1, &(vao->VertexBuffer)); // VBO - interleaved vertices and colors
+  glGenBuffers (1, &(vao->IndexBuffer)); // IBO - indices into VertexBuffer
+
+  bindVertexArray (vao->VertexArrayID); // Bind the VAO
+  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vao->IndexBuffer); // Recorded in the VAO
+  uploadMeshData(vao, mesh, usage);
+  setVertexAttributes(*mesh.layout);
+  bindVertexArray (0);
+}
+
+/* Generate VAO, VBO and return VAO handle - shared with any earlier mesh holding the same data */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode, const VertexLayout& layout)
+{
+  // Pack the vertices and keep one copy of each
+  MeshData mesh(layout);
+  appendVertices(mesh, numVertices, vertex_buffer_data, color_buffer_data);
+
+  unsigned long long h = 14695981039346656037ULL;
+  h = hashBytes(&primitive_mode, sizeof(primitive_mode), h);
+  h = hashBytes(&fill_mode, sizeof(fill_mode), h);
+  h = hashBytes(&layout.stride, sizeof(layout.stride), h);
+  h = hashBytes(&mesh.vertices[0], mesh.vertices.size(), h);
+  h = hashBytes(&mesh.indices[0], mesh.indices.size()*sizeof(GLuint), h);
+
+  auto range = mesh_registry.equal_range(h);
+  for (auto it = range.first; it != range.second; ++it) {
+    struct VAO* vao = it->second.vao;
+    const MeshData& data = it->second.data;
+    if (vao->PrimitiveMode == primitive_mode && vao->FillMode == fill_mode && data.layout == mesh.layout
+        && data.vertices == mesh.vertices && data.indices == mesh.indices) {
+      vao->RefCount++;
+      return vao;
+    }
+  }
+
+  struct VAO* vao = new struct VAO;
+  vao->PrimitiveMode = primitive_mode;
+  vao->FillMode = fill_mode;
+  vao->Hash = h;
+  vao->RefCount = 1;
+  setupVertexArray(vao, mesh, GL_STATIC_DRAW);
+
+  MeshRecord record;
+  record.vao = vao;
+  record.data = mesh;
+  mesh_registry.insert(make_pair(h, record));
+  return vao;
+}
+
+/* Generate VAO, VBO and return VAO handle - Common Color for all vertices */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode, const VertexLayout& layout)
+{
+  vector<GLfloat> color_buffer_data(3*numVertices);
+  for (int i=0; i<numVertices; i++) {
+    color_buffer_data [3*i] = red;
+    color_buffer_data [3*i + 1] = green;
+    color_buffer_data [3*i + 2] = blue;
+  }
+
+  return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode, layout);
+}
+
+struct VAO* createMutable3DObject (GLenum primitive_mode, const MeshData& mesh, GLenum fill_mode)
+{
+  struct VAO* vao = new struct VAO;
+  vao->PrimitiveMode = primitive_mode;
+  vao->FillMode = fill_mode;
+  vao->Hash = 0;  // never registered, so never shared
+  vao->RefCount = 1;
+  setupVertexArray(vao, mesh, GL_DYNAMIC_DRAW);
+  return vao;
+}
+
+/* Replace a mutable mesh's vertices. Respecifying the whole buffers lets
+ * the driver hand out fresh storage instead of waiting for draws still
+ * reading the old contents. */
+void update3DObject (struct VAO* vao, const MeshData& mesh)
+{
+  const VertexLayout* old_layout = vao->Layout;
+  // The index buffer binding belongs to the VAO, so bind it first
+  bindVertexArray (vao->VertexArrayID);
+  uploadMeshData(vao, mesh, GL_DYNAMIC_DRAW);
+  if (mesh.layout != old_layout)
+    setVertexAttributes(*mesh.layout);
+  bindVertexArray (0);
+}
+
+/* Drop one user of a mesh; the GL objects go away with the last one */
+void release3DObject (struct VAO* vao)
+{
+  if (--vao->RefCount > 0)
+    return;
+
+  auto range = mesh_registry.equal_range(vao->Hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.vao == vao) {
+      mesh_registry.erase(it);
+      break;
+    }
+  }
+  glDeleteBuffers(1, &(vao->VertexBuffer));
+  glDeleteBuffers(1, &(vao->IndexBuffer));
+  deleteVertexArray(vao->VertexArrayID);
+  delete vao;
+}
+
+/* Render the VBOs handled by VAO */
+void draw3DObject (struct VAO* vao)
+{
+    // Change the Fill Mode for this object, if it differs
+  setPolygonMode (vao->FillMode);
+
+    // Bind the VAO to use - attributes 0 (vertices) and 1 (colors) are enabled in it
+  bindVertexArray (vao->VertexArrayID);
+
+    // Draw the geometry !
+  glDrawElements(vao->PrimitiveMode, vao->NumIndices, vao->IndexType, (void*)0); // Every index from the start of IndexBuffer
+  render_stats.draw_calls++;
+}
+
+/* Generate a VAO that draws 'mesh' once per entry of 'instances' */
+struct InstancedVAO* createInstancedObject (struct VAO* mesh, const vector<TileInstance>& instances)
+{
+  struct InstancedVAO* ivao = new struct InstancedVAO;
+  ivao->Mesh = mesh;
+  ivao->NumInstances = instances.size();
+
+  glGenVertexArrays(1, &(ivao->VertexArrayID));
+  glGenBuffers (1, &(ivao->InstanceBuffer));
+  bindVertexArray (ivao->VertexArrayID);
+
+    // Per-vertex data and indices come from the mesh's own buffers
+  glBindBuffer (GL_ARRAY_BUFFER, mesh->VertexBuffer);
+  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, mesh->IndexBuffer);
+  setVertexAttributes(*mesh->Layout);
+
+    // Per-instance data: offset (attribute 2) and color (attribute 3), advanced once per instance
+  glBindBuffer (GL_ARRAY_BUFFER, ivao->InstanceBuffer);
+  glBufferData (GL_ARRAY_BUFFER, instances.size()*sizeof(TileInstance), instances.empty() ? NULL : &instances[0], GL_STATIC_DRAW);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(TileInstance), (void*)offsetof(TileInstance, offset));
+  glEnableVertexAttribArray(2);
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(TileInstance), (void*)offsetof(TileInstance, color));
+  glEnableVertexAttribArray(3);
+  glVertexAttribDivisor(3, 1);
+
+  bindVertexArray (0);
+  return ivao;
+}
+
+/* Replace the instances of a batch in a freshly orphaned buffer */
+void updateInstancedObject (struct InstancedVAO* ivao, const vector<TileInstance>& instances)
+{
+  GLsizeiptr size = instances.size()*sizeof(TileInstance);
+  ivao->NumInstances = instances.size();
+  glBindBuffer (GL_ARRAY_BUFFER, ivao->InstanceBuffer);
+    // Orphan the old store, so a draw still reading it does not hold up the
+    // write; the data is respecified often (debris every frame), hence STREAM
+  glBufferData (GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  if (size > 0)
+    glBufferSubData (GL_ARRAY_BUFFER, 0, size, &instances[0]);
+}
+
+void releaseInstancedObject (struct InstancedVAO* ivao)
+{
+  glDeleteBuffers(1, &(ivao->InstanceBuffer));
+  deleteVertexArray(ivao->VertexArrayID);
+  delete ivao;
+}
+
+/* Render every instance of an InstancedVAO in a single draw call */
+void drawInstancedObject (struct InstancedVAO* ivao)
+{
+  if (ivao->NumInstances == 0)
+    return;
+  setPolygonMode (ivao->Mesh->FillMode);
+  bindVertexArray (ivao->VertexArrayID);
+  glDrawElementsInstanced(ivao->Mesh->PrimitiveMode, ivao->Mesh->NumIndices, ivao->Mesh->IndexType, (void*)0, ivao->NumInstances);
+  render_stats.draw_calls++;
+}
+
+void resetRenderStats ()
+{
+  render_stats = RenderStats();
+}
+
+size_t meshGPUBytes (const struct VAO* vao)
+{
+  size_t index_size = vao->IndexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  return (size_t) vao->NumVertices * vao->Layout->stride + (size_t) vao->NumIndices * index_size;
+}
+
+void printMeshRegistry (FILE* out)
+{
+  size_t total = 0;
+  fprintf(out, "%-18s %8s %8s %6s %10s\n", "mesh", "vertices", "indices", "users", "GPU bytes");
+  for (auto it = mesh_registry.begin(); it != mesh_registry.end(); ++it) {
+    const struct VAO* vao = it->second.vao;
+    fprintf(out, "%016llx   %8d %8d %6d %10zu\n", vao->Hash, vao->NumVertices, vao->NumIndices, vao->RefCount, meshGPUBytes(vao));
+    total += meshGPUBytes(vao);
+  }
+  fprintf(out, "%zu meshes, %zu bytes total\n", mesh_registry.size(), total);
+}
@@ -0,0 +1,120 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdio.h>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* How one vertex attribute is stored inside a vertex */
+struct VertexAttribute {
+  GLint size;            // components the shader reads
+  GLenum type;           // GL_FLOAT, GL_HALF_FLOAT or GL_UNSIGNED_BYTE (normalized)
+  GLboolean normalized;
+  int offset;            // bytes from the start of the vertex
+};
+
+/* Vertex format of a mesh: position in attribute 0, color in attribute 1 */
+struct VertexLayout {
+  VertexAttribute position;
+  VertexAttribute color;
+  int stride;
+};
+
+/* 24 bytes a vertex: float xyz, float rgb */
+extern const VertexLayout LAYOUT_FLOAT;
+/* 12 bytes a vertex: half-float xyz and normalized byte rgb, each padded
+ * to 4-byte alignment. Half floats keep 11 significant bits, so positions
+ * on a quarter-unit grid are exact up to 512 units from the origin. */
+extern const VertexLayout LAYOUT_PACKED;
+
+/* Unique vertices packed in a layout, and the indices that draw them */
+struct MeshData {
+  const VertexLayout* layout;
+  std::vector<unsigned char> vertices;
+  std::vector<GLuint> indices;
+
+  MeshData (const VertexLayout& l = LAYOUT_PACKED) : layout(&l) {}
+  int numVertices () const { return vertices.size()/layout->stride; }
+};
+
+/* Append n vertices, given as float xyz positions moved by offset and rgb
+ * colors. Vertices repeated within the run are stored once, so append in
+ * small runs (a face, a tile, a small object). */
+void appendVertices (MeshData& mesh, int n, const GLfloat* positions, const GLfloat* colors, glm::vec3 offset=glm::vec3(0));
+
+/* A mesh on the GPU: unique vertices in VertexBuffer, in the format given
+ * by Layout, drawn through IndexBuffer. Handles are shared: create3DObject
+ * returns the same VAO for identical geometry, so release it with
+ * release3DObject. */
+struct VAO {
+  GLuint VertexArrayID;
+  GLuint VertexBuffer;
+  GLuint IndexBuffer;
+
+  GLenum PrimitiveMode;
+  GLenum FillMode;
+  int NumVertices;  // unique vertices
+  int NumIndices;   // vertices drawn
+  GLenum IndexType; // GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT past 65536 vertices
+  const VertexLayout* Layout;
+
+  unsigned long long Hash;
+  int RefCount;
+};
+typedef struct VAO VAO;
+
+/* One instanced batch: a shared mesh plus a per-instance offset/color buffer */
+struct InstancedVAO {
+  GLuint VertexArrayID;
+  GLuint InstanceBuffer;
+
+  struct VAO* Mesh;
+  int NumInstances;
+};
+typedef struct InstancedVAO InstancedVAO;
+
+/* Per-instance data, interleaved in InstanceBuffer */
+struct TileInstance {
+  glm::vec3 offset;
+  glm::vec3 color;
+};
+
+/* Counters reset at the start of every frame */
+struct RenderStats {
+  int draw_calls;
+  int uniform_uploads;
+  int chunks_drawn, chunks_culled;  // tile chunks, counted once per view
+  int tiles_drawn, tiles_culled;
+  int fence_waits;                  // frames the CPU had to wait for the GPU
+  int camera_updates;               // cameras whose matrices were rebuilt
+  int state_calls;                  // GL state calls that reached the driver
+  int state_redundant;              // calls that would not have changed anything
+};
+extern RenderStats render_stats;
+
+void resetRenderStats ();
+
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL, const VertexLayout& layout=LAYOUT_PACKED);
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL, const VertexLayout& layout=LAYOUT_PACKED);
+/* An unshared mesh, for geometry that is rebuilt in place with update3DObject */
+struct VAO* createMutable3DObject (GLenum primitive_mode, const MeshData& mesh, GLenum fill_mode=GL_FILL);
+void update3DObject (struct VAO* vao, const MeshData& mesh);
+void release3DObject (struct VAO* vao);
+void draw3DObject (struct VAO* vao);
+
+struct InstancedVAO* createInstancedObject (struct VAO* mesh, const std::vector<TileInstance>& instances);
+void updateInstancedObject (struct InstancedVAO* ivao, const std::vector<TileInstance>& instances);
+/* Delete a batch; its mesh belongs to the caller and stays */
+void releaseInstancedObject (struct InstancedVAO* ivao);
+void drawInstancedObject (struct InstancedVAO* ivao);
+
+/* Bytes of vertex and index data a mesh holds on the GPU */
+size_t meshGPUBytes (const struct VAO* vao);
+/* Print every registered mesh with its users and GPU memory */
+void printMeshRegistry (FILE* out);
+
+#endif
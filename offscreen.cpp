@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "offscreen.h"
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+static GLuint framebuffer, colorbuffer, depthbuffer;
+
+/* Prefer Mesa's surfaceless platform, which needs neither X nor a GPU */
+static EGLDisplay openDisplay ()
+{
+  const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+      EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+      if (d != EGL_NO_DISPLAY)
+        return d;
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool createOffscreenContext ()
+{
+  EGLint major, minor;
+  display = openDisplay();
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    fprintf(stderr, "EGL: no display available\n");
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr, "EGL: desktop OpenGL not supported\n");
+    return false;
+  }
+
+  static const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint configs = 0;
+  if (!eglChooseConfig(display, config_attribs, &config, 1, &configs) || configs == 0) {
+    fprintf(stderr, "EGL: no suitable config\n");
+    return false;
+  }
+
+  static const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "EGL: cannot create an OpenGL 3.3 core context\n");
+    return false;
+  }
+
+  // Rendering goes to an FBO, so a surface is only needed when the
+  // driver cannot make a context current without one
+  const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+    static const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  }
+  if (!eglMakeCurrent(display, surface, surface, context)) {
+    fprintf(stderr, "EGL: cannot make the context current\n");
+    return false;
+  }
+  return true;
+}
+
+bool createOffscreenFramebuffer (int width, int height)
+{
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+  glGenRenderbuffers(1, &colorbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+
+  glGenRenderbuffers(1, &depthbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+    return false;
+  }
+  return true;
+}
+
+void destroyOffscreenContext ()
+{
+  if (framebuffer) {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorbuffer);
+    glDeleteRenderbuffers(1, &depthbuffer);
+    framebuffer = 0;
+  }
+  if (display != EGL_NO_DISPLAY) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface != EGL_NO_SURFACE)
+      eglDestroySurface(display, surface);
+    if (context != EGL_NO_CONTEXT)
+      eglDestroyContext(display, context);
+    eglTerminate(display);
+  }
+  display = EGL_NO_DISPLAY;
+  context = EGL_NO_CONTEXT;
+  surface = EGL_NO_SURFACE;
+}
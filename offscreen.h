@@ -0,0 +1,16 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+/* Headless OpenGL 3.3 core context through EGL, for running without a
+ * display (e.g. on Mesa's software rasterizer). Rendering goes into a
+ * framebuffer object instead of a window. */
+
+/* Create and make current the EGL context; call before initGLEW().
+ * A GLEW built for GLX may then report a missing GLX display: it loads
+ * the GL entry points before that check, so the message is harmless. */
+bool createOffscreenContext ();
+/* Create and bind a width x height color+depth FBO; call after initGLEW() */
+bool createOffscreenFramebuffer (int width, int height);
+void destroyOffscreenContext ();
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <GL/glew.h>
+#include "alloc.h"
+#include "profiler.h"
+
+using namespace std;
+
+#define RING_SIZE (1 << 16)
+
+/* A slot's sequence number is the index it was written for plus one,
+ * or 0 while a writer is filling it in. Readers copy the event and
+ * keep it only if the sequence number is unchanged afterwards. */
+struct RingSlot {
+  atomic<unsigned long long> seq;
+  ProfileEvent event;
+};
+
+static RingSlot ring[RING_SIZE];
+static atomic<unsigned long long> ring_head(0);
+
+static atomic<bool> enabled(false);
+static chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+static atomic<int> current_frame(0);  // set by the main thread, read by every recorder
+
+/* GPU queries waiting for their result, and finished ones to reuse */
+struct PendingQuery {
+  GLuint id;
+  const char* name;
+  int frame;
+  double start_us;
+};
+static vector<PendingQuery> pending;
+static vector<GLuint> free_queries;
+
+void profilerEnable (bool on)
+{
+  enabled = on;
+}
+
+bool profilerEnabled ()
+{
+  return enabled.load(memory_order_relaxed);
+}
+
+double profilerNow ()
+{
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+static void recordFrame (const char* name, int frame, int track, double start_us, double duration_us)
+{
+  unsigned long long index = ring_head.fetch_add(1, memory_order_relaxed);
+  RingSlot& slot = ring[index & (RING_SIZE-1)];
+  slot.seq.store(0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.event.name = name;
+  slot.event.frame = frame;
+  slot.event.track = track;
+  slot.event.start_us = start_us;
+  slot.event.duration_us = duration_us;
+  slot.seq.store(index + 1, memory_order_release);
+}
+
+void profilerRecord (const char* name, int track, double start_us, double duration_us)
+{
+  if (profilerEnabled())
+    recordFrame(name, current_frame.load(memory_order_relaxed), track, start_us, duration_us);
+}
+
+/* Move finished GPU queries into the ring; with 'wait' block for all */
+static void collectQueries (bool wait)
+{
+  size_t kept = 0;
+  for (size_t i=0; i<pending.size(); i++) {
+    GLint available = GL_TRUE;
+    if (!wait)
+      glGetQueryObjectiv(pending[i].id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      pending[kept++] = pending[i];
+      continue;
+    }
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(pending[i].id, GL_QUERY_RESULT, &ns);
+    recordFrame(pending[i].name, pending[i].frame, TRACK_GPU, pending[i].start_us, ns / 1000.0);
+    free_queries.push_back(pending[i].id);
+  }
+  pending.resize(kept);
+}
+
+void profilerBeginFrame (int frame)
+{
+  current_frame.store(frame, memory_order_relaxed);
+  if (!pending.empty())
+    collectQueries(false);
+}
+
+void profilerFlushGPU ()
+{
+  collectQueries(true);
+}
+
+ProfileScope::ProfileScope (const char* scope_name, bool gpu) : name(scope_name), start(0), query(0), active(false)
+{
+  // Allocations are tagged with the scope even when nothing is timed
+  prev_tag = allocSetTag(scope_name);
+  if (!profilerEnabled())
+    return;
+  active = true;
+  if (gpu) {
+    if (free_queries.empty()) {
+      GLuint id;
+      glGenQueries(1, &id);
+      free_queries.push_back(id);
+    }
+    query = free_queries.back();
+    free_queries.pop_back();
+    glBeginQuery(GL_TIME_ELAPSED, query);
+  }
+  start = profilerNow();
+}
+
+ProfileScope::~ProfileScope ()
+{
+  allocSetTag(prev_tag);
+  if (!active)
+    return;
+  double end = profilerNow();
+  if (query) {
+    glEndQuery(GL_TIME_ELAPSED);
+    PendingQuery p = { query, name, current_frame.load(memory_order_relaxed), start };
+    pending.push_back(p);
+  }
+  recordFrame(name, current_frame.load(memory_order_relaxed), TRACK_CPU, start, end - start);
+}
+
+/* Copy out the events still in the ring, oldest first */
+static vector<ProfileEvent> snapshot ()
+{
+  vector<ProfileEvent> events;
+  unsigned long long head = ring_head.load(memory_order_acquire);
+  unsigned long long first = head > RING_SIZE ? head - RING_SIZE : 0;
+  for (unsigned long long index=first; index<head; index++) {
+    RingSlot& slot = ring[index & (RING_SIZE-1)];
+    if (slot.seq.load(memory_order_acquire) != index + 1)
+      continue;
+    ProfileEvent event = slot.event;
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.seq.load(memory_order_relaxed) == index + 1)
+      events.push_back(event);
+  }
+  return events;
+}
+
+bool profilerWriteTrace (const char* path)
+{
+  static const char* track_names[] = { "CPU", "GPU" };
+  vector<ProfileEvent> events = snapshot();
+  FILE* out = fopen(path, "w");
+  if (!out) {
+    fprintf(stderr, "Cannot write trace %s\n", path);
+    return false;
+  }
+
+  size_t length = strlen(path);
+  if (length >= 5 && !strcmp(path + length - 5, ".json")) {
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    int tracks = 2;
+    for (size_t i=0; i<events.size(); i++)
+      tracks = max(tracks, events[i].track + 1);
+    for (int t=0; t<tracks; t++) {
+      char name[32];
+      if (t < TRACK_WORKER)
+        snprintf(name, sizeof(name), "%s", track_names[t]);
+      else
+        snprintf(name, sizeof(name), "worker %d", t - TRACK_WORKER + 1);
+      fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", t ? "," : "", t, name);
+    }
+    for (size_t i=0; i<events.size(); i++)
+      fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+        events[i].name, events[i].track == TRACK_GPU ? "gpu" : "cpu", events[i].track,
+        events[i].start_us, events[i].duration_us, events[i].frame);
+    fprintf(out, "\n]}\n");
+  }
+  else {
+    fprintf(out, "frame,name,track,start_us,duration_us\n");
+    for (size_t i=0; i<events.size(); i++) {
+      char track[32];
+      if (events[i].track < TRACK_WORKER)
+        snprintf(track, sizeof(track), "%s", events[i].track == TRACK_GPU ? "gpu" : "cpu");
+      else
+        snprintf(track, sizeof(track), "worker%d", events[i].track - TRACK_WORKER + 1);
+      fprintf(out, "%d,%s,%s,%.3f,%.3f\n", events[i].frame, events[i].name, track, events[i].start_us, events[i].duration_us);
+    }
+  }
+  fclose(out);
+  fprintf(stderr, "Wrote %d trace events to %s\n", (int)events.size(), path);
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/* Frame profiler. Scoped CPU timers and GL_TIME_ELAPSED queries write
+ * events into a fixed-size lock-free ring; the most recent events can
+ * be exported as CSV or as Chrome trace-event JSON (chrome://tracing,
+ * Perfetto). Everything is a no-op while the profiler is disabled. */
+
+/* Timeline rows in the exported trace */
+enum ProfileTrack {
+  TRACK_CPU = 0,  // main thread
+  TRACK_GPU = 1,  // GPU time measured with timer queries
+  TRACK_WORKER = 2  // job worker w runs on track TRACK_WORKER + w - 1
+};
+
+struct ProfileEvent {
+  const char* name;   // must outlive the profiler - use string literals
+  int frame;
+  int track;
+  double start_us;    // since the profiler was first enabled
+  double duration_us;
+};
+
+void profilerEnable (bool on);
+bool profilerEnabled ();
+
+/* Microseconds on the profiler's clock */
+double profilerNow ();
+
+/* Start a new frame: stamps later events and collects finished GPU queries */
+void profilerBeginFrame (int frame);
+/* Block until every outstanding GPU query has its result */
+void profilerFlushGPU ();
+
+/* Append one event; safe to call from any thread */
+void profilerRecord (const char* name, int track, double start_us, double duration_us);
+
+/* Write the events still held in the ring; ".json" gives Chrome trace
+ * format, anything else CSV */
+bool profilerWriteTrace (const char* path);
+
+/* Times the enclosing scope on the CPU, and with gpu=true also on the
+ * GPU. GPU scopes must not nest: GL allows one GL_TIME_ELAPSED query
+ * at a time. Heap allocations inside the scope are tracked under its
+ * name. */
+struct ProfileScope {
+  const char* name;
+  double start;
+  unsigned query;
+  bool active;
+  const char* prev_tag;  // allocation tag to restore on exit
+
+  ProfileScope(const char* scope_name, bool gpu=false);
+  ~ProfileScope();
+};
+
+#endif
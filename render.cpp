@@ -0,0 +1,69 @@
+#include <algorithm>
+#include "glstate.h"
+#include "render.h"
+
+using namespace std;
+
+/* view:4 | program:8 | vertex array:24 | fill:1 | depth:16 | unused:11 */
+static unsigned long long sortKey (int view, GLuint program, GLuint vertex_array, GLenum fill_mode, float depth)
+{
+  unsigned long long d = (unsigned long long) (min(max(depth, 0.0f), 1.0f)*65535);
+  return (unsigned long long) (view & 0xf) << 60
+    | (unsigned long long) (program & 0xff) << 52
+    | (unsigned long long) (vertex_array & 0xffffff) << 28
+    | (unsigned long long) (fill_mode != GL_FILL) << 27
+    | d << 11;
+}
+
+void clearRenderQueue (RenderQueue& queue)
+{
+  queue.items.clear();
+}
+
+void queueDraw (RenderQueue& queue, int view, GLuint program, struct VAO* mesh, int transform, float depth)
+{
+  DrawItem item;
+  item.key = sortKey(view, program, mesh->VertexArrayID, mesh->FillMode, depth);
+  item.mesh = mesh;
+  item.batch = NULL;
+  item.program = program;
+  item.transform = transform;
+  item.view = view;
+  queue.items.push_back(item);
+}
+
+void queueDrawInstanced (RenderQueue& queue, int view, GLuint program, struct InstancedVAO* batch, float depth)
+{
+  if (batch->NumInstances == 0)
+    return;
+  DrawItem item;
+  item.key = sortKey(view, program, batch->VertexArrayID, batch->Mesh->FillMode, depth);
+  item.mesh = batch->Mesh;
+  item.batch = batch;
+  item.program = program;
+  item.transform = -1;
+  item.view = view;
+  queue.items.push_back(item);
+}
+
+void submitRenderQueue (RenderQueue& queue, const TransformRing& ring, const function<void(int)>& select_view)
+{
+  vector<DrawItem>& items = queue.items;
+  sort(items.begin(), items.end(), [] (const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+  bindTransforms(ring);
+  int view = -1;
+  for (size_t i=0; i<items.size(); i++) {
+    const DrawItem& item = items[i];
+    if (item.view != view) {
+      select_view(item.view);
+      view = item.view;
+    }
+    useProgram(item.program);
+    if (item.transform >= 0 && !selectTransform(ring, item.program, item.transform))
+      continue;
+    if (item.batch)
+      drawInstancedObject(item.batch);
+    else
+      draw3DObject(item.mesh);
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <vector>
+#include <functional>
+#include "mesh.h"
+#include "transforms.h"
+
+/* One draw of the frame, with the state it needs. The 64-bit key orders
+ * draws by view, then program, then mesh, then fill mode, then depth, so
+ * that after sorting each view is selected once, draws sharing a program
+ * and mesh run back to back, and ties are drawn nearest first. */
+struct DrawItem {
+  unsigned long long key;
+  struct VAO* mesh;              // drawn with draw3DObject, unless
+  struct InstancedVAO* batch;    // this is set
+  GLuint program;
+  int transform;                 // transform ring slot, or -1 for none
+  int view;
+};
+
+/* The frame's draws, collected in any order. The storage is kept from
+ * frame to frame. */
+struct RenderQueue {
+  std::vector<DrawItem> items;
+};
+
+void clearRenderQueue (RenderQueue& queue);
+/* 'depth' is the distance from the view's camera as a fraction of its
+ * far plane */
+void queueDraw (RenderQueue& queue, int view, GLuint program, struct VAO* mesh, int transform, float depth);
+void queueDrawInstanced (RenderQueue& queue, int view, GLuint program, struct InstancedVAO* batch, float depth);
+/* Sort the queue and draw it through the GL state cache, calling
+ * select_view whenever the next draw is in another view */
+void submitRenderQueue (RenderQueue& queue, const TransformRing& ring, const std::function<void(int)>& select_view);
+
+#endif
@@ -0,0 +1,131 @@
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include "replay.h"
+
+using namespace std;
+
+bool parseMove (const string& token, Move& m)
+{
+  for (int i=0; i<4; i++) {
+    if (token == moveName((Move) i)) {
+      m = (Move) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool readMoveScripts (const char* path, vector<MoveScript>& scripts)
+{
+  ifstream in(path);
+  if (!in.is_open()) {
+    fprintf(stderr, "Cannot open move script %s\n", path);
+    return false;
+  }
+  string line;
+  int number = 0;
+  while (getline(in, line)) {
+    number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos || line[first] == '#' || line[first] == ';')
+      continue;
+    MoveScript script;
+    script.name = string(path) + ":" + to_string(number);
+    script.text.swap(line);
+    scripts.push_back(script);
+  }
+  return true;
+}
+
+ReplayResult replayScript (const Level& level, const string& text)
+{
+  ReplayResult result;
+  result.outcome = BLOCK_OK;
+  result.valid = true;
+  result.moves = 0;
+  result.fall_step = -1;
+
+  BlockState block = startState(level);
+  const char* p = text.c_str();
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',')
+      p++;
+    if (!*p)
+      break;
+    const char* end = p;
+    while (*end && *end != ' ' && *end != '\t' && *end != '\r' && *end != ',')
+      end++;
+
+    Move m;
+    if (!parseMove(string(p, end), m)) {
+      result.valid = false;
+      return result;
+    }
+    p = end;
+
+    if (result.outcome != BLOCK_OK)
+      continue;
+    result.outcome = stepBlock(level, block, m);
+    result.moves++;
+    if (result.outcome == BLOCK_FELL)
+      result.fall_step = result.moves;
+  }
+  return result;
+}
+
+/* Workers take scripts in small batches off a shared counter, so long
+ * and short scripts even out without any locking */
+static void replayWorker (const Level& level, const vector<MoveScript>& scripts, vector<ReplayResult>& results, atomic<size_t>& cursor)
+{
+  const size_t batch = 16;
+  for (;;) {
+    size_t begin = cursor.fetch_add(batch);
+    if (begin >= scripts.size())
+      return;
+    size_t end = min(begin + batch, scripts.size());
+    for (size_t i=begin; i<end; i++)
+      results[i] = replayScript(level, scripts[i].text);
+  }
+}
+
+vector<ReplayResult> replayScripts (const Level& level, const vector<MoveScript>& scripts, int threads)
+{
+  if (threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+
+  vector<ReplayResult> results(scripts.size());
+  atomic<size_t> cursor(0);
+  vector<thread> workers;
+  for (int t=1; t<threads; t++)
+    workers.push_back(thread(replayWorker, cref(level), cref(scripts), ref(results), ref(cursor)));
+  replayWorker(level, scripts, results, cursor);
+  for (size_t t=0; t<workers.size(); t++)
+    workers[t].join();
+  return results;
+}
+
+/* A CSV field in quotes, with quotes inside it doubled (RFC 4180), so
+ * that commas and quotes in a script name stay in its column */
+static void writeCSVField (FILE* out, const string& field)
+{
+  fputc('"', out);
+  for (size_t i=0; i<field.size(); i++) {
+    if (field[i] == '"')
+      fputc('"', out);
+    fputc(field[i], out);
+  }
+  fputc('"', out);
+}
+
+void writeReplayResults (FILE* out, const vector<MoveScript>& scripts, const vector<ReplayResult>& results)
+{
+  fprintf(out, "script,result,moves,fall_step\n");
+  for (size_t i=0; i<scripts.size(); i++) {
+    const ReplayResult& r = results[i];
+    const char* outcome = !r.valid ? "invalid" : r.outcome == BLOCK_WON ? "win" : r.outcome == BLOCK_FELL ? "fall" : "incomplete";
+    writeCSVField(out, scripts[i].name);
+    fprintf(out, ",%s,%d,%d\n", outcome, r.moves, r.fall_step);
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "level.h"
+#include "block.h"
+
+/* A move script is a line of move names (UP, DOWN, LEFT, RIGHT), the
+ * same moves the arrow keys make. Script files hold one script per
+ * line; blank lines and lines starting with '#' or ';' are skipped. */
+struct MoveScript {
+  std::string name;  // file:line it was read from
+  std::string text;
+};
+
+struct ReplayResult {
+  BlockStatus outcome;  // BLOCK_OK means the script ended on the tiles
+  bool valid;           // false if the script had an unknown move name
+  int moves;            // moves applied before the block won or fell
+  int fall_step;        // 1-based move that made the block fall, or -1
+};
+
+bool parseMove (const std::string& token, Move& m);
+bool readMoveScripts (const char* path, std::vector<MoveScript>& scripts);
+
+/* Replay one script from the level's start; moves after a win or a
+ * fall are ignored */
+ReplayResult replayScript (const Level& level, const std::string& text);
+
+/* Replay every script on 'threads' workers (0 picks the hardware
+ * thread count). Results come back in script order. */
+std::vector<ReplayResult> replayScripts (const Level& level, const std::vector<MoveScript>& scripts, int threads=0);
+
+/* One CSV row per script: script,result,moves,fall_step */
+void writeReplayResults (FILE* out, const std::vector<MoveScript>& scripts, const std::vector<ReplayResult>& results);
+
+#endif
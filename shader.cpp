@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include "shader.h"
+
+using namespace std;
+
+const char* shader_cache_dir = "shader_cache";
+
+/* Cache file: this header followed by 'length' bytes of program binary */
+struct ProgramCacheHeader {
+  char magic[4];  // "BLKS"
+  GLenum format;
+  GLint length;
+};
+
+/* Whole file into 'text' in one read */
+static bool readShader (const char* path, string& text)
+{
+  ifstream in(path, ios::in | ios::binary);
+  if (!in.is_open()) {
+    fprintf(stderr, "Cannot open shader %s\n", path);
+    return false;
+  }
+  ostringstream buffer;
+  buffer << in.rdbuf();
+  text = buffer.str();
+  return true;
+}
+
+/* 64-bit FNV-1a over a string, continuing from h */
+static unsigned long long hashString (const string& s, unsigned long long h)
+{
+  for (size_t i=0; i<s.size(); i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Cache file for these sources: a binary is only valid for the driver
+ * that produced it, so the driver strings are part of the key */
+static string cachePath (const string& vertex_code, const string& fragment_code)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  h = hashString(vertex_code, h);
+  h = hashString(string(1, '\0'), h);
+  h = hashString(fragment_code, h);
+  const GLenum driver_strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+  for (int i=0; i<3; i++) {
+    const char* s = (const char*) glGetString(driver_strings[i]);
+    h = hashString(string(1, '\0') + (s ? s : ""), h);
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin", h);
+  return string(shader_cache_dir) + name;
+}
+
+static bool programBinarySupported ()
+{
+  GLint formats = 0;
+  if (!GLEW_ARB_get_program_binary)
+    return false;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+/* Program from a cached binary, or 0 if there is none or the driver
+ * rejects it (for example after a driver update) */
+static GLuint loadCachedProgram (const string& path)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f)
+    return 0;
+  ProgramCacheHeader header;
+  vector<char> binary;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "BLKS", 4) == 0 && header.length > 0;
+  if (ok) {
+    binary.resize(header.length);
+    ok = fread(&binary[0], 1, binary.size(), f) == binary.size();
+  }
+  fclose(f);
+  if (!ok)
+    return 0;
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, &binary[0], binary.size());
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+static void saveCachedProgram (const string& path, GLuint program)
+{
+  ProgramCacheHeader header;
+  memcpy(header.magic, "BLKS", 4);
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0)
+    return;
+  vector<char> binary(header.length);
+  glGetProgramBinary(program, header.length, NULL, &header.format, &binary[0]);
+
+  // Written beside the cache file and renamed over it once complete, so a
+  // crash or a full disk never leaves a truncated binary to be loaded
+  mkdir(shader_cache_dir, 0755);
+  string temp_path = path + ".tmp";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    fprintf(stderr, "Cannot write shader cache %s\n", temp_path.c_str());
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+    && fwrite(&binary[0], 1, binary.size(), f) == binary.size();
+  if (fclose(f) != 0)
+    ok = false;
+  if (ok && rename(temp_path.c_str(), path.c_str()) != 0)
+    ok = false;
+  if (!ok) {
+    fprintf(stderr, "Cannot write shader cache %s\n", path.c_str());
+    remove(temp_path.c_str());
+  }
+}
+
+/* Compile one shader stage, printing the log on failure */
+static GLuint compileShader (GLenum type, const char* path, const string& code)
+{
+  GLuint shader = glCreateShader(type);
+  const char* source = code.c_str();
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+
+  GLint compiled = GL_FALSE, log_length = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
+    vector<char> log(max(log_length, 1), '\0');
+    glGetShaderInfoLog(shader, log.size(), NULL, &log[0]);
+    fprintf(stderr, "Cannot compile shader %s:\n%s\n", path, &log[0]);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+GLuint LoadShaders (const char* vertex_file_path, const char* fragment_file_path)
+{
+  string vertex_code, fragment_code;
+  if (!readShader(vertex_file_path, vertex_code) || !readShader(fragment_file_path, fragment_code))
+    return 0;
+
+  bool cache = shader_cache_dir && programBinarySupported();
+  string cache_path;
+  if (cache) {
+    cache_path = cachePath(vertex_code, fragment_code);
+    GLuint program = loadCachedProgram(cache_path);
+    if (program)
+      return program;
+  }
+
+  GLuint vertex_shader = compileShader(GL_VERTEX_SHADER, vertex_file_path, vertex_code);
+  GLuint fragment_shader = compileShader(GL_FRAGMENT_SHADER, fragment_file_path, fragment_code);
+  if (!vertex_shader || !fragment_shader) {
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  if (cache)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  glLinkProgram(program);
+  glDetachShader(program, vertex_shader);
+  glDetachShader(program, fragment_shader);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  GLint linked = GL_FALSE, log_length = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_length);
+    vector<char> log(max(log_length, 1), '\0');
+    glGetProgramInfoLog(program, log.size(), NULL, &log[0]);
+    fprintf(stderr, "Cannot link %s + %s:\n%s\n", vertex_file_path, fragment_file_path, &log[0]);
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  if (cache)
+    saveCachedProgram(cache_path, program);
+  return program;
+}
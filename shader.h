@@ -0,0 +1,16 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+/* Directory for linked program binaries; NULL turns the cache off */
+extern const char* shader_cache_dir;
+
+/* Build a program from a vertex and a fragment shader file. A program
+ * linked earlier from the same sources on the same driver is loaded from
+ * the cache instead of being compiled. Read, compile and link errors go
+ * to stderr with the driver's log, and 0 is returned. */
+GLuint LoadShaders (const char* vertex_file_path, const char* fragment_file_path);
+
+#endif
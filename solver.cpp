@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "solver.h"
+
+using namespace std;
+
+/* Reusable barrier for the fixed set of search workers */
+struct Barrier {
+  mutex m;
+  condition_variable cv;
+  int count, waiting, generation;
+
+  Barrier(int n) : count(n), waiting(0), generation(0) {}
+
+  void wait ()
+  {
+    unique_lock<mutex> lock(m);
+    int gen = generation;
+    if (++waiting == count) {
+      waiting = 0;
+      generation++;
+      cv.notify_all();
+      return;
+    }
+    cv.wait(lock, [&] { return gen != generation; });
+  }
+};
+
+/* Index of a (x, z, orientation) state; 64-bit, since levels past 2^30
+ * cells have more states than 32 bits can number */
+typedef size_t StateIndex;
+
+/* Search state shared by all workers */
+struct Search {
+  const Level* level;
+  int width;
+
+  vector<atomic<unsigned long long> > visited;  // one bit per state
+  vector<unsigned char> via;                     // move that first reached each state
+
+  vector<StateIndex> frontier;
+  vector<vector<StateIndex> > next;                // per-worker next layer
+  atomic<size_t> cursor;
+  atomic<long long> explored;
+
+  atomic<bool> found;
+  const atomic<bool>* cancel;                     // may be NULL
+  StateIndex goal_from;                           // state the winning move was made from
+  Move goal_move;
+  bool done;
+
+  Search(size_t states) : visited((states + 63) / 64), via(states, 0xff) {}
+};
+
+static inline StateIndex stateIndex (const BlockState& s, int width)
+{
+  return ((StateIndex) s.z * width + s.x) * 3 + s.orient;
+}
+
+static inline BlockState stateAt (StateIndex index, int width)
+{
+  BlockState s;
+  s.orient = (Orientation) (index % 3);
+  s.x = (index / 3) % width;
+  s.z = (index / 3) / width;
+  return s;
+}
+
+/* Mark a state visited; true if this call was the first to do so */
+static inline bool claim (Search& search, StateIndex index)
+{
+  unsigned long long bit = 1ULL << (index & 63);
+  atomic<unsigned long long>& word = search.visited[index >> 6];
+  if (word.load(memory_order_relaxed) & bit)
+    return false;
+  return !(word.fetch_or(bit, memory_order_relaxed) & bit);
+}
+
+static void expandLayer (Search& search, int worker)
+{
+  const size_t chunk = 256;
+  vector<StateIndex>& out = search.next[worker];
+  long long explored = 0;
+
+  for (;;) {
+    // A cancelled search drops the rest of the layer
+    if (search.cancel && search.cancel->load(memory_order_relaxed))
+      break;
+    size_t begin = search.cursor.fetch_add(chunk);
+    if (begin >= search.frontier.size())
+      break;
+    size_t end = min(begin + chunk, search.frontier.size());
+    explored += end - begin;
+
+    for (size_t i=begin; i<end; i++) {
+      BlockState s = stateAt(search.frontier[i], search.width);
+      for (int m=0; m<4; m++) {
+        BlockState n = s;
+        BlockStatus status = stepBlock(*search.level, n, (Move) m);
+        if (status == BLOCK_FELL)
+          continue;
+        if (status == BLOCK_WON) {
+          bool expected = false;
+          if (search.found.compare_exchange_strong(expected, true)) {
+            search.goal_from = search.frontier[i];
+            search.goal_move = (Move) m;
+          }
+          continue;
+        }
+        StateIndex index = stateIndex(n, search.width);
+        if (claim(search, index)) {
+          search.via[index] = m;
+          out.push_back(index);
+        }
+      }
+    }
+  }
+  search.explored += explored;
+}
+
+/* Worker 0 also swaps layers between the two barriers */
+static void searchWorker (Search& search, Barrier& barrier, int worker)
+{
+  for (;;) {
+    expandLayer(search, worker);
+    barrier.wait();
+    if (worker == 0) {
+      search.frontier.clear();
+      for (size_t t=0; t<search.next.size(); t++) {
+        search.frontier.insert(search.frontier.end(), search.next[t].begin(), search.next[t].end());
+        search.next[t].clear();
+      }
+      search.cursor = 0;
+      search.done = search.found || search.frontier.empty() ||
+        (search.cancel && search.cancel->load(memory_order_relaxed));
+    }
+    barrier.wait();
+    if (search.done)
+      return;
+  }
+}
+
+SolveResult solveLevel (const Level& level, BlockState start, int threads, const atomic<bool>* cancel)
+{
+  SolveResult result;
+  result.solved = false;
+  result.states_explored = 0;
+
+  if (threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+
+  BlockStatus status = checkBlock(level, start);
+  if (status != BLOCK_OK) {
+    result.solved = status == BLOCK_WON;
+    return result;
+  }
+
+  Search search((size_t) level.width * level.depth * 3);
+  for (size_t i=0; i<search.visited.size(); i++)
+    search.visited[i].store(0, memory_order_relaxed);
+  search.level = &level;
+  search.width = level.width;
+  search.next.resize(threads);
+  search.cursor = 0;
+  search.explored = 0;
+  search.found = false;
+  search.cancel = cancel;
+  search.done = false;
+
+  StateIndex start_index = stateIndex(start, level.width);
+  claim(search, start_index);
+  search.frontier.push_back(start_index);
+
+  Barrier barrier(threads);
+  vector<thread> workers;
+  for (int t=1; t<threads; t++)
+    workers.push_back(thread(searchWorker, ref(search), ref(barrier), t));
+  searchWorker(search, barrier, 0);
+  for (size_t t=0; t<workers.size(); t++)
+    workers[t].join();
+
+  result.states_explored = search.explored;
+  if (!search.found)
+    return result;
+
+  // Walk back from the goal by undoing the move that reached each state
+  result.solved = true;
+  result.moves.push_back(search.goal_move);
+  StateIndex index = search.goal_from;
+  while (index != start_index) {
+    Move m = (Move) search.via[index];
+    result.moves.push_back(m);
+    index = stateIndex(step(stateAt(index, level.width), inverseMove(m)), level.width);
+  }
+  reverse(result.moves.begin(), result.moves.end());
+  return result;
+}
+
+SolveResult solveLevel (const Level& level, int threads, const atomic<bool>* cancel)
+{
+  return solveLevel(level, startState(level), threads, cancel);
+}
@@ -0,0 +1,23 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <vector>
+#include <atomic>
+#include "level.h"
+#include "block.h"
+
+struct SolveResult {
+  bool solved;
+  std::vector<Move> moves;       // a shortest winning move sequence
+  long long states_explored;     // states taken off the frontier
+};
+
+/* Breadth-first search over every (x, z, orientation) the block can
+ * reach from 'start'. Visited states live in a bitset of 3 bits per
+ * cell; each BFS layer is split across 'threads' workers (0 picks the
+ * hardware thread count). Setting *cancel gives up the search soon
+ * after, unsolved. */
+SolveResult solveLevel (const Level& level, BlockState start, int threads=0, const std::atomic<bool>* cancel=NULL);
+SolveResult solveLevel (const Level& level, int threads=0, const std::atomic<bool>* cancel=NULL);
+
+#endif
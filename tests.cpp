@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <vector>
+#include "level.h"
+#include "block.h"
+#include "solver.h"
+#include "generator.h"
+
+using namespace std;
+
+/* Checks of the GL-free game core: the block rules, the solver and the
+ * generator. Run from the repository root (make test); prints each
+ * failure and exits non-zero if there was any. */
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      failures++; \
+    } \
+  } while (0)
+
+/* A level from rows of text, as in a level file */
+static void makeLevel (Level& level, const char* const* rows, int depth)
+{
+  int width = 0;
+  for (int z=0; z<depth; z++)
+    while (rows[z][width])
+      width++;
+  level.width = width;
+  level.depth = depth;
+  level.storage.assign((size_t) width*depth, TILE_EMPTY);
+  for (int z=0; z<depth; z++)
+    for (int x=0; x<width; x++) {
+      unsigned char& cell = level.storage[(size_t) z*width + x];
+      switch (rows[z][x]) {
+        case '#': cell = TILE_SOLID; break;
+        case 'B': cell = TILE_BREAKABLE; break;
+        case 'G': cell = TILE_GOAL; level.goal_x = x; level.goal_z = z; break;
+        case 'S': cell = TILE_SOLID; level.start_x = x; level.start_z = z; break;
+      }
+    }
+  level.cells = &level.storage[0];
+}
+
+/* Every roll from every orientation is undone by its inverse */
+static void testInverseMoves ()
+{
+  for (int o=0; o<3; o++)
+    for (int m=0; m<4; m++) {
+      BlockState s = { 5, 7, (Orientation) o };
+      BlockState there = step(s, (Move) m);
+      CHECK(!(there == s), "%s from orientation %d did not move", moveName((Move) m), o);
+      CHECK(step(there, inverseMove((Move) m)) == s, "%s from orientation %d is not undone by %s",
+        moveName((Move) m), o, moveName(inverseMove((Move) m)));
+      CHECK(inverseMove(inverseMove((Move) m)) == (Move) m, "inverse of %s is not an involution", moveName((Move) m));
+    }
+}
+
+/* What carries the block, standing and lying */
+static void testCheckBlock ()
+{
+  static const char* rows[] = {
+    "#BG",
+    "##.",
+  };
+  Level level;
+  makeLevel(level, rows, 2);
+  BlockState standing_solid = { 0, 0, ORIENT_STANDING };
+  BlockState standing_breakable = { 1, 0, ORIENT_STANDING };
+  BlockState standing_goal = { 2, 0, ORIENT_STANDING };
+  BlockState lying_breakable = { 0, 0, ORIENT_LYING_X };
+  BlockState lying_goal = { 1, 0, ORIENT_LYING_X };
+  BlockState lying_z = { 0, 0, ORIENT_LYING_Z };
+  BlockState half_off = { 1, 1, ORIENT_LYING_X };
+  BlockState off_grid = { -1, 0, ORIENT_STANDING };
+  CHECK(checkBlock(level, standing_solid) == BLOCK_OK, "standing on a tile");
+  CHECK(checkBlock(level, standing_breakable) == BLOCK_FELL, "standing on a breakable tile");
+  CHECK(checkBlock(level, standing_goal) == BLOCK_WON, "standing on the goal");
+  CHECK(checkBlock(level, lying_breakable) == BLOCK_OK, "lying across a breakable tile");
+  CHECK(checkBlock(level, lying_goal) == BLOCK_OK, "lying across the goal");
+  CHECK(checkBlock(level, lying_z) == BLOCK_OK, "lying along z");
+  CHECK(checkBlock(level, half_off) == BLOCK_FELL, "lying half off the tiles");
+  CHECK(checkBlock(level, off_grid) == BLOCK_FELL, "standing off the grid");
+}
+
+/* Play 'moves' from the start; the status after the last one, and
+ * whether any earlier move already ended the game */
+static BlockStatus playMoves (const Level& level, const vector<Move>& moves, bool& ended_early)
+{
+  BlockState s = startState(level);
+  BlockStatus status = BLOCK_OK;
+  ended_early = false;
+  for (size_t i=0; i<moves.size(); i++) {
+    if (status != BLOCK_OK)
+      ended_early = true;
+    status = stepBlock(level, s, moves[i]);
+  }
+  return status;
+}
+
+/* Is the level winnable within 'depth' moves from s? Plain exhaustive
+ * search, to check the solver against */
+static bool winnableWithin (const Level& level, BlockState s, int depth)
+{
+  if (depth == 0)
+    return false;
+  for (int m=0; m<4; m++) {
+    BlockState n = s;
+    BlockStatus status = stepBlock(level, n, (Move) m);
+    if (status == BLOCK_WON || (status == BLOCK_OK && winnableWithin(level, n, depth - 1)))
+      return true;
+  }
+  return false;
+}
+
+/* The solver's answer wins, and nothing shorter does */
+static void checkSolution (const Level& level, const SolveResult& result, const char* name)
+{
+  CHECK(result.solved, "%s is not solved", name);
+  if (!result.solved)
+    return;
+  bool ended_early;
+  CHECK(playMoves(level, result.moves, ended_early) == BLOCK_WON, "%s: solution does not win", name);
+  CHECK(!ended_early, "%s: solution ends the game before its last move", name);
+  CHECK(!winnableWithin(level, startState(level), result.moves.size() - 1),
+    "%s: winnable in fewer than %d moves", name, (int) result.moves.size());
+}
+
+static void testSolverOnLevel1 ()
+{
+  Level level;
+  CHECK(loadLevel("levels/level1.txt", level), "levels/level1.txt does not load");
+  if (!level.cells)
+    return;
+  SolveResult one = solveLevel(level, 1);
+  SolveResult many = solveLevel(level, 4);
+  checkSolution(level, one, "level1 on 1 thread");
+  CHECK(one.moves.size() == 7, "level1 solved in %d moves, expected 7", (int) one.moves.size());
+  CHECK(many.solved && many.moves.size() == one.moves.size(), "level1 on 4 threads: %d moves", (int) many.moves.size());
+
+  // The same level read back from its binary form solves the same way
+  if (saveLevelBinary("tests_level1.bin", level)) {
+    Level binary;
+    CHECK(loadLevelBinary("tests_level1.bin", binary), "binary level1 does not load");
+    CHECK(levelHash(binary) == levelHash(level), "binary level1 differs from the text one");
+    SolveResult again = solveLevel(binary, 1);
+    CHECK(again.solved && again.moves.size() == one.moves.size(), "binary level1 solved in %d moves", (int) again.moves.size());
+    remove("tests_level1.bin");
+  }
+}
+
+/* Every generated level is solvable in exactly the moves the generator
+ * reports, and the same seed gives the same levels */
+static void testGeneratorAgreesWithSolver ()
+{
+  GeneratorParams params = { 12, 10, 8, 7, 20 };
+  vector<GeneratedLevel> levels = generateLevels(params, 12, 4);
+  vector<GeneratedLevel> again = generateLevels(params, 12, 1);
+  for (size_t i=0; i<levels.size(); i++) {
+    const GeneratedLevel& g = levels[i];
+    char name[32];
+    snprintf(name, sizeof(name), "generated level %d", (int) i);
+    CHECK(g.min_moves > 0, "%s has no solution", name);
+    if (g.min_moves <= 0)
+      continue;
+    SolveResult result = solveLevel(g.level, 1);
+    CHECK(result.solved && (int) result.moves.size() == g.min_moves, "%s: generator says %d moves, solver %d",
+      name, g.min_moves, (int) result.moves.size());
+    if ((int) result.moves.size() <= 12)
+      checkSolution(g.level, result, name);
+    CHECK(levelHash(again[i].level) == levelHash(g.level), "%s differs between runs", name);
+  }
+}
+
+int main ()
+{
+  testInverseMoves();
+  testCheckBlock();
+  testSolverOnLevel1();
+  testGeneratorAgreesWithSolver();
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "mesh.h"
+#include "transforms.h"
+#include "glstate.h"
+
+using namespace std;
+
+static void allocateRing (TransformRing& ring, int capacity)
+{
+  ring.capacity = capacity;
+  glBindBuffer(GL_TEXTURE_BUFFER, ring.buffer);
+  glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr) TRANSFORM_REGIONS*capacity*sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+  // Re-attach, so the texture sees the new store on any driver
+  glActiveTexture(GL_TEXTURE0 + TRANSFORM_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, ring.texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, ring.buffer);
+}
+
+void createTransformRing (TransformRing& ring, int capacity)
+{
+  // Every matrix is four RGBA32F texels, and all regions share one texture
+  GLint max_texels;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  ring.max_capacity = max_texels/4/TRANSFORM_REGIONS;
+  ring.region = 0;
+  ring.nprograms = 0;
+  for (int r=0; r<TRANSFORM_REGIONS; r++)
+    ring.fences[r] = 0;
+  glGenBuffers(1, &ring.buffer);
+  glGenTextures(1, &ring.texture);
+  allocateRing(ring, min(capacity, ring.max_capacity));
+}
+
+void attachTransforms (TransformRing& ring, GLuint program)
+{
+  if (ring.nprograms == TRANSFORM_PROGRAMS) {
+    fprintf(stderr, "transforms: more than %d programs read the transform ring\n", TRANSFORM_PROGRAMS);
+    return;
+  }
+  useProgram(program);
+  glUniform1i(glGetUniformLocation(program, "Models"), TRANSFORM_UNIT);
+  ring.programs[ring.nprograms] = program;
+  ring.index_locations[ring.nprograms] = glGetUniformLocation(program, "ObjectIndex");
+  ring.nprograms++;
+}
+
+void uploadTransforms (TransformRing& ring, const vector<glm::mat4>& models)
+{
+  static bool reported_size = false, reported_map = false;
+  if (models.empty())
+    return;
+  ring.region = (ring.region + 1) % TRANSFORM_REGIONS;
+
+  int count = models.size();
+  if (count > ring.capacity && ring.capacity < ring.max_capacity) {
+    // Respecifying the store gives fresh memory, so old fences no longer matter
+    for (int r=0; r<TRANSFORM_REGIONS; r++) {
+      if (ring.fences[r])
+        glDeleteSync(ring.fences[r]);
+      ring.fences[r] = 0;
+    }
+    allocateRing(ring, min(max(count, ring.capacity*2), ring.max_capacity));
+  }
+  if (count > ring.capacity) {
+    if (!reported_size)
+      fprintf(stderr, "transforms: %d objects, but the buffer texture only holds %d per frame; the rest are not drawn\n",
+        count, ring.capacity);
+    reported_size = true;
+    count = ring.capacity;
+  }
+
+  GLsync& fence = ring.fences[ring.region];
+  if (fence) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      // The GPU is more than two frames behind; only now does the CPU wait
+      render_stats.fence_waits++;
+      glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+    }
+    glDeleteSync(fence);
+    fence = 0;
+  }
+
+  // The fence says the GPU is done with the region, so no driver sync is needed
+  GLintptr offset = (GLintptr) ring.region*ring.capacity*sizeof(glm::mat4);
+  GLsizeiptr size = (GLsizeiptr) count*sizeof(glm::mat4);
+  glBindBuffer(GL_TEXTURE_BUFFER, ring.buffer);
+  void* slots = glMapBufferRange(GL_TEXTURE_BUFFER, offset, size,
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  bool written = false;
+  if (slots) {
+    memcpy(slots, &models[0][0][0], size);
+    written = glUnmapBuffer(GL_TEXTURE_BUFFER) == GL_TRUE;  // false if the store was lost
+  }
+  if (!written) {
+    // The draws must not read last time's matrices, so copy them the slow way
+    if (!reported_map)
+      fprintf(stderr, "transforms: could not map the transform buffer, writing it with glBufferSubData\n");
+    reported_map = true;
+    glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &models[0][0][0]);
+  }
+  render_stats.uniform_uploads++;
+}
+
+void bindTransforms (const TransformRing& ring)
+{
+  glActiveTexture(GL_TEXTURE0 + TRANSFORM_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, ring.texture);
+}
+
+bool selectTransform (const TransformRing& ring, GLuint program, int index)
+{
+  if (index >= ring.capacity)
+    return false;
+  for (int p=0; p<ring.nprograms; p++)
+    if (ring.programs[p] == program) {
+      glUniform1i(ring.index_locations[p], ring.region*ring.capacity + index);
+      return true;
+    }
+  return false;
+}
+
+void fenceTransforms (TransformRing& ring)
+{
+  if (ring.fences[ring.region])
+    glDeleteSync(ring.fences[ring.region]);
+  ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,52 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* Texture unit of the Models buffer texture */
+#define TRANSFORM_UNIT 0
+#define TRANSFORM_REGIONS 3
+#define TRANSFORM_PROGRAMS 4
+
+/* Per-object model matrices, one frame's worth per region of a single
+ * buffer, packed 64 bytes apiece and read by the shaders as a buffer
+ * texture. Each region is written once per frame and fenced, and a
+ * region is only rewritten TRANSFORM_REGIONS frames later, by which time
+ * the GPU is normally done with it. The texture is bound once per frame;
+ * a draw only sets its program's ObjectIndex uniform. */
+struct TransformRing {
+  GLuint buffer, texture;
+  int capacity;     // matrices per region
+  int max_capacity; // most the buffer texture can address per region
+  int region;       // region written this frame
+  GLsync fences[TRANSFORM_REGIONS];
+  int nprograms;    // programs that read the ring, and where their
+  GLuint programs[TRANSFORM_PROGRAMS];         // ObjectIndex is
+  GLint index_locations[TRANSFORM_PROGRAMS];
+};
+
+void createTransformRing (TransformRing& ring, int capacity);
+/* Let 'program' read the ring: its Models sampler goes to
+ * TRANSFORM_UNIT, and its ObjectIndex location is remembered */
+void attachTransforms (TransformRing& ring, GLuint program);
+
+/* Write this frame's matrices into the next region in one mapped pass.
+ * The ring grows if they do not fit. */
+void uploadTransforms (TransformRing& ring, const std::vector<glm::mat4>& models);
+
+/* Bind the ring's texture for this frame's draws */
+void bindTransforms (const TransformRing& ring);
+/* Point 'program' at matrix 'index' of this frame; false if the ring
+ * could not hold it, or the program does not read the ring */
+bool selectTransform (const TransformRing& ring, GLuint program, int index);
+
+/* Mark the region as in use by the draws issued so far; call once all
+ * of the frame's draws are submitted */
+void fenceTransforms (TransformRing& ring);
+
+#endif